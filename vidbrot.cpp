@@ -7,19 +7,29 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdarg.h>
 #include <limits.h>
 #include <errno.h>
 #include <string.h>
+#include <ctype.h>
 #include <math.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/time.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <sys/mman.h>
 #include <sys/ioctl.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <setjmp.h>
+#include <immintrin.h>
 #include <linux/videodev2.h>
+#include <jpeglib.h>
 #define GL_GLEXT_PROTOTYPES
 #include <GL/openglut.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
 
 //
 // typedefs and defines
@@ -28,14 +38,25 @@
 template <typename T> void clear( T &x ) { memset( &x, 0, sizeof(x) ); }
 template <typename T> void clear( T &x, int count ) { memset( &x, 0, sizeof(x) * count ); }
 
-#define FAIL(x) do { printf x; printf( "\n" ); exit( 1 ); } while (0)
-#define DBUG(x) do { printf x; printf( "\n" ); } while (0)
+// messages go to stderr, so that stdout can carry video
+static void msg( const char *fmt, ... ) __attribute__((format(printf, 1, 2)));
+static void msg( const char *fmt, ... )
+{
+    va_list ap;
+    va_start( ap, fmt );
+    vfprintf( stderr, fmt, ap );
+    va_end( ap );
+    fputc( '\n', stderr );
+}
+
+#define FAIL(x) do { msg x; exit( 1 ); } while (0)
+#define DBUG(x) do { msg x; } while (0)
 
 #define CHECK_GLERROR() \
 do { \
     GLenum err = glGetError(); \
     if (err != GL_NO_ERROR) \
-    	printf( "%s(%d): GL Error %s\n", __FILE__, __LINE__, gluErrorString( err ) ); \
+    	fprintf( stderr, "%s(%d): GL Error %s\n", __FILE__, __LINE__, gluErrorString( err ) ); \
 } while (0)
 
 #define MK_SPECIALKEY(x) (0x100|x)
@@ -61,7 +82,17 @@ _("Animate Translation Phase  [t]",'t',case 't':,(animate_translation_phase ^= t
 _("Reset Translation Phase  [T]",'T',case 'T':,(trans_phase = M_PI/4)) \
 _("Toggle mirror  [b]",'b',case 'b':,(mirror ^= true)) \
 _("Toggle poles  [p]",'p',case 'p':,(showpoles ^= true)) \
+_("Hold Frame Rate  [g]",'g',case 'g':,(governing ^= true)) \
+_("Toggle escape bailout  [e]",'e',case 'e':,(bailout ^= true)) \
+_("Sample YUYV directly  [y]",'y',case 'y':,(yuv_direct ^= true)) \
+_("Inputs by tile/iteration  [l]",'l',case 'l':,(layer_by_trip ^= true)) \
+_("Deep Zoom  [z]",'z',case 'z':,((deep_zoom ^= true), clamp_zoom())) \
+_("Progressive Rendering  [a]",'a',case 'a':,(progressive ^= true)) \
+_("Cache Orbits  [c]",'c',case 'c':,(orbit_caching ^= true)) \
 _("Reset Zoom  [r]",'r',case 'r':,((cx = 0), (cy = -0.5), (zoom = 1.5))) \
+_("Capture At Window Size  [w]",'w',case 'w':,recapture( scr_w, scr_h )) \
+_("Capture Larger  [>]",'>',case '>':,recapture_step( 1 )) \
+_("Capture Smaller  [<]",'<',case '<':,recapture_step( -1 )) \
 _("Exit  [Esc]",27,case 27:,exit(0))
 
 // tweakable constants
@@ -71,23 +102,89 @@ static const bool use_aniso = true;
 static const char *WINDOW_TITLE = "VidBrot";
 
 //
-// vid_capture - manage video device capture
+// now_ms - milliseconds on the monotonic clock
 //
 
-class vid_capture
+static double now_ms()
 {
-private:
-    int			fd;
-    int			n_buffers;
-    struct buffer
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return( ts.tv_sec * 1.0e3 + ts.tv_nsec * 1.0e-6 );
+}
+
+//
+// frame_source - anything that produces video frames in a small set of numbered buffers
+//
+// get() hands out the index of a filled buffer (or -1 if none is ready yet),
+// data() points at its pixels and release() gives it back to be refilled.
+// Everything past the capture stage works on YUYV, sources that produce
+// something else get wrapped in a frame_converter.
+//
+
+class frame_source
+{
+public:
+    virtual ~frame_source() {}
+
+    virtual int width() = 0;
+    virtual int height() = 0;
+    virtual int bytesperline() = 0;
+    virtual int bytesperframe() = 0;
+    virtual int buffercount() = 0;
+    virtual uint32_t pixelformat() { return( V4L2_PIX_FMT_YUYV ); }
+    // bytesused - size of the frame in buffer i, which varies for compressed formats
+    virtual size_t bytesused( int i ) { return( bytesperframe() ); }
+    // timestamp - when the frame in buffer i was captured, in now_ms() time, -1 if unknown
+    virtual double timestamp( int i ) { return( -1 ); }
+
+    virtual void start() = 0;
+    virtual void stop() = 0;
+    // wait - wait up to timeout_ms for a frame to be ready
+    virtual bool wait( int timeout_ms = 2000 ) = 0;
+    virtual int get() = 0;
+    virtual void *data( int i ) = 0;
+    virtual void release( int i ) = 0;
+};
+
+//
+// fourcc_from_name - V4L2 pixel format for "yuyv", "nv12", "i420" or "mjpeg", 0 if unknown
+//
+
+static uint32_t fourcc_from_name( const char *name )
+{
+    if (!strcasecmp( name, "yuyv" )) return( V4L2_PIX_FMT_YUYV );
+    if (!strcasecmp( name, "nv12" )) return( V4L2_PIX_FMT_NV12 );
+    if (!strcasecmp( name, "i420" ) || !strcasecmp( name, "yu12" )) return( V4L2_PIX_FMT_YUV420 );
+    if (!strcasecmp( name, "mjpeg" ) || !strcasecmp( name, "mjpg" )) return( V4L2_PIX_FMT_MJPEG );
+    return( 0 );
+}
+
+//
+// fourcc_cost - how much work a pixel format is to turn into YUYV, -1 if we can't
+//
+
+static int fourcc_cost( uint32_t fourcc )
+{
+    switch (fourcc)
     {
-	void			*start;
-	size_t			length;
-	struct v4l2_buffer	info;
-    };
-    buffer		*buffers;
+    case V4L2_PIX_FMT_YUYV: return( 0 );
+    case V4L2_PIX_FMT_NV12: return( 1 );
+    case V4L2_PIX_FMT_YUV420: return( 2 );
+    case V4L2_PIX_FMT_MJPEG: return( 3 );
+    case V4L2_PIX_FMT_JPEG: return( 3 );
+    }
+    return( -1 );
+}
+
+//
+// v4l2_device - what vid_capture and vid_output have in common: the device node and its ioctls
+//
+
+class v4l2_device
+{
+protected:
+    int			fd;
     char		*dev_name;
-    struct v4l2_format	fmt;
 
     // xioctl - perform an ioctl, retrying for EINTRs
     int xioctl( int request, void *arg )
@@ -102,24 +199,62 @@ private:
 	FAIL(( "%s error %d (%s)", s, errno, strerror( errno ) ));
     }
 
-public:
-    vid_capture( int n_buffers = 4 ) : fd(-1), n_buffers(n_buffers), dev_name(NULL)
+    // dequeue - take a buffer the driver is done with, false if there is none yet
+    bool dequeue( v4l2_buf_type type, v4l2_memory memory, struct v4l2_buffer &buf )
     {
-	buffers = new buffer[n_buffers];
-	clear( *buffers, n_buffers );
-	clear( fmt );
-	if (verbose) DBUG(( "Creating vid_capture with %d buffers", n_buffers ));
+	clear( buf );
+	buf.type = type;
+	buf.memory = memory;
+
+	if (-1 == xioctl( VIDIOC_DQBUF, &buf ))
+	{
+	    switch (errno)
+	    {
+	    case EAGAIN: return( false );
+	    case EIO: // (could ignore EIO, see spec) fall through...
+	    default: errno_exit( "VIDIOC_DQBUF" );
+	    }
+	}
+	return( true );
     }
 
-    ~vid_capture()
+    // poll_fd - wait up to timeout_ms for the device to have a buffer to dequeue
+    bool poll_fd( int timeout_ms, bool writing )
     {
-	if (buffers)
+	bool ready = false;
+	while (!ready)
 	{
-	    unmap();
-	    delete [] buffers;
+	    fd_set fds;
+	    FD_ZERO( &fds );
+	    FD_SET( fd, &fds );
+
+	    struct timeval tv;
+	    tv.tv_sec = timeout_ms / 1000;
+	    tv.tv_usec = (timeout_ms % 1000) * 1000;
+
+	    int r = select( fd + 1, writing ? NULL : &fds, writing ? &fds : NULL, NULL, &tv );
+
+	    if (-1 == r)
+	    {
+		if (EINTR == errno) continue;
+		errno_exit( "select" );
+	    }
+	    // timeout
+	    if (0 == r) break;
+
+	    ready = true;
 	}
+	return( ready );
+    }
+
+public:
+    v4l2_device() : fd(-1), dev_name(NULL) {}
+
+    virtual ~v4l2_device()
+    {
 	if (fd >= 0) close( fd );
 	fd = -1;
+	delete [] dev_name;
     }
 
     void open( const char *name )
@@ -142,8 +277,144 @@ public:
         sprintf( name, "/dev/video%d", dev_num );
 	open( name );
     }
+};
+
+//
+// vid_capture - manage video device capture
+//
+
+class vid_capture : public frame_source, public v4l2_device
+{
+private:
+    int			n_buffers;
+    v4l2_memory		memory;			// MMAP, or USERPTR into caller-owned memory
+    struct buffer
+    {
+	void			*start;
+	size_t			length;
+	size_t			used;			// bytes in the last frame dequeued into it
+	double			stamp;			// and when the driver says it was captured
+	bool			queued;
+	struct v4l2_buffer	info;
+    };
+    buffer		*buffers;
+    struct v4l2_format	fmt;
+    double		rate;			// frame rate the driver says it's running at, 0 if unknown
+
+    // candidate - a format and size the device offers, and its best frame rate (0 if unknown)
+    struct candidate
+    {
+	uint32_t	fourcc;
+	int		w, h;
+	double		fps;
+    };
+
+    // max_fps - fastest frame interval the device offers for a format and size, 0 if it won't say
+    double max_fps( uint32_t fourcc, int w, int h )
+    {
+	double best = 0;
+	struct v4l2_frmivalenum fi;
+	clear( fi );
+	fi.pixel_format = fourcc;
+	fi.width = w;
+	fi.height = h;
+	for (fi.index = 0; 0 == xioctl( VIDIOC_ENUM_FRAMEINTERVALS, &fi ); ++fi.index)
+	{
+	    // stepwise and continuous ranges report their shortest interval in min
+	    const struct v4l2_fract &t = (V4L2_FRMIVAL_TYPE_DISCRETE == fi.type) ? fi.discrete : fi.stepwise.min;
+	    if (t.numerator > 0 && t.denominator / double(t.numerator) > best) best = t.denominator / double(t.numerator);
+	    if (V4L2_FRMIVAL_TYPE_DISCRETE != fi.type) break;
+	}
+	return( best );
+    }
+
+    // better - whether a beats b for a width x height capture at fps: reaching the
+    // frame rate comes first, then the size closest to the one asked for (larger on
+    // a tie), then the format that is cheapest to convert
+    static bool better( const candidate &a, const candidate &b, int width, int height, double fps )
+    {
+	bool a_fast = fps <= 0 || a.fps <= 0 || a.fps >= 0.95 * fps;
+	bool b_fast = fps <= 0 || b.fps <= 0 || b.fps >= 0.95 * fps;
+	if (a_fast != b_fast) return( a_fast );
+	double a_err = fabs( log( a.w * double(a.h) / (width * double(height)) ) );
+	double b_err = fabs( log( b.w * double(b.h) / (width * double(height)) ) );
+	if (fabs( a_err - b_err ) > 1e-6) return( a_err < b_err );
+	if (a.w * a.h != b.w * b.h) return( a.w * a.h > b.w * b.h );
+	return( fourcc_cost( a.fourcc ) < fourcc_cost( b.fourcc ) );
+    }
+
+    // negotiate - walk VIDIOC_ENUM_FMT/FRAMESIZES/FRAMEINTERVALS for the format and size
+    // to capture, only considering fourcc if it isn't 0
+    candidate negotiate( int width, int height, double fps, uint32_t fourcc )
+    {
+	candidate best;
+	clear( best );
+	struct v4l2_fmtdesc desc;
+	clear( desc );
+	desc.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	for (desc.index = 0; 0 == xioctl( VIDIOC_ENUM_FMT, &desc ); ++desc.index)
+	{
+	    if (fourcc_cost( desc.pixelformat ) < 0 || (fourcc && fourcc != desc.pixelformat)) continue;
+
+	    struct v4l2_frmsizeenum fs;
+	    clear( fs );
+	    fs.pixel_format = desc.pixelformat;
+	    for (fs.index = 0; ; ++fs.index)
+	    {
+		candidate c;
+		c.fourcc = desc.pixelformat;
+		if (-1 == xioctl( VIDIOC_ENUM_FRAMESIZES, &fs ))
+		{
+		    // drivers that don't enumerate sizes get asked for the one we want
+		    if (fs.index > 0) break;
+		    c.w = width;
+		    c.h = height;
+		}
+		else if (V4L2_FRMSIZE_TYPE_DISCRETE == fs.type)
+		{
+		    c.w = fs.discrete.width;
+		    c.h = fs.discrete.height;
+		}
+		else
+		{
+		    // a range: the size we want, clamped and snapped to the step
+		    const struct v4l2_frmsize_stepwise &r = fs.stepwise;
+		    int sw = r.step_width ? r.step_width : 1, sh = r.step_height ? r.step_height : 1;
+		    c.w = r.min_width + (width > int(r.min_width) ? (width - r.min_width) / sw * sw : 0);
+		    c.h = r.min_height + (height > int(r.min_height) ? (height - r.min_height) / sh * sh : 0);
+		    if (c.w > int(r.max_width)) c.w = r.max_width;
+		    if (c.h > int(r.max_height)) c.h = r.max_height;
+		}
+		c.fps = max_fps( c.fourcc, c.w, c.h );
+		if (verbose) DBUG(( "%s offers %.4s %dx%d at up to %.1f fps", dev_name, (const char *)&c.fourcc, c.w, c.h, c.fps ));
+		if (!best.fourcc || better( c, best, width, height, fps )) best = c;
+		if (V4L2_FRMSIZE_TYPE_DISCRETE != fs.type) break;
+	    }
+	}
+	return( best );
+    }
+
+public:
+    vid_capture( int n_buffers = 4 ) : n_buffers(n_buffers), memory(V4L2_MEMORY_MMAP), rate(0)
+    {
+	buffers = new buffer[n_buffers];
+	clear( *buffers, n_buffers );
+	clear( fmt );
+	if (verbose) DBUG(( "Creating vid_capture with %d buffers", n_buffers ));
+    }
+
+    ~vid_capture()
+    {
+	if (buffers)
+	{
+	    unmap();
+	    delete [] buffers;
+	}
+    }
 
-    void init( int width = 640, int height = 480 )
+    // init - set the device up to capture as close to width x height at fps as it can,
+    // in the pixel format fourcc, or whichever suits best if that is 0
+    void init( int width = 640, int height = 480, double fps = 30, uint32_t fourcc = 0 )
     {
         struct v4l2_capability cap;
         if (-1 == xioctl( VIDIOC_QUERYCAP, &cap ))
@@ -170,39 +441,114 @@ public:
 	    xioctl( VIDIOC_S_CROP, &crop );
         }
 
+	candidate c = negotiate( width, height, fps, fourcc );
+	if (!c.fourcc)
+	{
+	    if (fourcc) FAIL(( "%s can't capture %.4s", dev_name, (const char *)&fourcc ));
+	    FAIL(( "%s offers none of YUYV, NV12, YU12 or MJPEG", dev_name ));
+	}
+
         clear( fmt );
         fmt.type                = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        fmt.fmt.pix.width       = width;
-        fmt.fmt.pix.height      = height;
-        fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_YUYV;
+        fmt.fmt.pix.width       = c.w;
+        fmt.fmt.pix.height      = c.h;
+        fmt.fmt.pix.pixelformat = c.fourcc;
         fmt.fmt.pix.field       = V4L2_FIELD_INTERLACED;
         if (-1 == xioctl( VIDIOC_S_FMT, &fmt )) errno_exit( "VIDIOC_S_FMT" );
-	if (V4L2_PIX_FMT_YUYV != fmt.fmt.pix.pixelformat) FAIL(( "YUYV unsupported" ));
+	if (c.fourcc != fmt.fmt.pix.pixelformat) FAIL(( "%.4s unsupported", (const char *)&c.fourcc ));
 	// VIDIOC_S_FMT may change width and height, must query!
 
-        // buggy driver paranoia
-        unsigned int min = fmt.fmt.pix.width * 2;
-        if (fmt.fmt.pix.bytesperline < min) fmt.fmt.pix.bytesperline = min;
-        min = fmt.fmt.pix.bytesperline * fmt.fmt.pix.height;
-        if (fmt.fmt.pix.sizeimage < min) fmt.fmt.pix.sizeimage = min;
+        // buggy driver paranoia, compressed frames are whatever size they are
+	if (V4L2_PIX_FMT_MJPEG != c.fourcc && V4L2_PIX_FMT_JPEG != c.fourcc)
+	{
+	    bool packed = (V4L2_PIX_FMT_YUYV == c.fourcc);
+	    unsigned int min = fmt.fmt.pix.width * (packed ? 2 : 1);
+	    if (fmt.fmt.pix.bytesperline < min) fmt.fmt.pix.bytesperline = min;
+	    min = fmt.fmt.pix.bytesperline * fmt.fmt.pix.height * (packed ? 2 : 3) / 2;
+	    if (fmt.fmt.pix.sizeimage < min) fmt.fmt.pix.sizeimage = min;
+	}
+
+	// ask for the frame rate if the driver lets us, and see what we got
+	struct v4l2_streamparm parm;
+	clear( parm );
+	parm.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	if (fps > 0 && 0 == xioctl( VIDIOC_G_PARM, &parm ) && (parm.parm.capture.capability & V4L2_CAP_TIMEPERFRAME))
+	{
+	    parm.parm.capture.timeperframe.numerator = 1000;
+	    parm.parm.capture.timeperframe.denominator = (unsigned)(fps * 1000 + 0.5);
+	    if (-1 == xioctl( VIDIOC_S_PARM, &parm )) DBUG(( "%s can't be set to %g fps (%s)", dev_name, fps, strerror( errno ) ));
+	}
+	rate = 0;
+	if (0 == xioctl( VIDIOC_G_PARM, &parm ) && parm.parm.capture.timeperframe.numerator)
+	    rate = parm.parm.capture.timeperframe.denominator / double(parm.parm.capture.timeperframe.numerator);
 
 	// ready to map
-	if (verbose) DBUG(( "Ready to map (%dx%d)", fmt.fmt.pix.width, fmt.fmt.pix.height ));
+	if (verbose) DBUG(( "Ready to map (%.4s %dx%d at %.2f fps)", (const char *)&c.fourcc, fmt.fmt.pix.width, fmt.fmt.pix.height, rate ));
     }
 
     int width() { return( fmt.fmt.pix.width ); }
     int height() { return( fmt.fmt.pix.height ); }
     int bytesperline() { return( fmt.fmt.pix.bytesperline ); }
     int bytesperframe() { return( fmt.fmt.pix.sizeimage ); }
+    int buffercount() { return( n_buffers ); }
+    uint32_t pixelformat() { return( fmt.fmt.pix.pixelformat ); }
+    size_t bytesused( int i ) { return( (i < 0 || i >= n_buffers) ? 0 : buffers[i].used ); }
+    double timestamp( int i ) { return( (i < 0 || i >= n_buffers) ? -1 : buffers[i].stamp ); }
+    bool userptr() { return( V4L2_MEMORY_USERPTR == memory ); }
+    double fps() { return( rate ); }
+
+    // step_size - the next frame size up (dir > 0) or down from the current one in
+    // the current format, false if there isn't one
+    bool step_size( int dir, int &w, int &h )
+    {
+	int area = width() * height(), best = 0;
+	struct v4l2_frmsizeenum fs;
+	clear( fs );
+	fs.pixel_format = pixelformat();
+	for (fs.index = 0; 0 == xioctl( VIDIOC_ENUM_FRAMESIZES, &fs ); ++fs.index)
+	{
+	    if (V4L2_FRMSIZE_TYPE_DISCRETE != fs.type)
+	    {
+		// a range: half as big again, or two thirds, and init() snaps it to a step
+		w = (dir > 0) ? width() * 3 / 2 : width() * 2 / 3;
+		h = (dir > 0) ? height() * 3 / 2 : height() * 2 / 3;
+		return( w >= int(fs.stepwise.min_width) && w <= int(fs.stepwise.max_width) );
+	    }
+	    int a = fs.discrete.width * fs.discrete.height;
+	    if ((dir > 0 ? a > area : a < area) && (!best || (dir > 0 ? a < best : a > best)))
+	    {
+		best = a;
+		w = fs.discrete.width;
+		h = fs.discrete.height;
+	    }
+	}
+	return( best > 0 );
+    }
+
+    // free_buffers - unmap and hand all buffers back to the driver, so that the
+    // format can be changed
+    void free_buffers()
+    {
+	unmap();
+        struct v4l2_requestbuffers req;
+        clear( req );
+        req.count               = 0;
+        req.type                = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        req.memory              = memory;
+	if (-1 == xioctl( VIDIOC_REQBUFS, &req )) errno_exit( "VIDIOC_REQBUFS" );
+	memory = V4L2_MEMORY_MMAP;
+    }
 
     void unmap()
     {
 	for (int i = 0; i < n_buffers; ++i)
 	    if (buffers[i].length > 0)
 	    {
-		munmap( buffers[i].start, buffers[i].length );
+		// user pointers belong to whoever handed them to map_userptr()
+		if (V4L2_MEMORY_MMAP == memory) munmap( buffers[i].start, buffers[i].length );
 		buffers[i].start = NULL;
 		buffers[i].length = 0;
+		buffers[i].queued = false;
 	    }
     }
 
@@ -224,8 +570,11 @@ public:
         if (req.count < 2) FAIL(( "insufficient buffer memory on %s (%d buffers available)", dev_name, req.count ));
 
 	unmap();
+	memory = V4L2_MEMORY_MMAP;
+	// the driver may hand back more buffers than we asked for, just don't use them
+	if (int(req.count) < n_buffers) n_buffers = req.count;
 
-        for (int i = 0; i < req.count; ++i)
+        for (int i = 0; i < n_buffers; ++i)
 	{
 	    clear( buffers[i].info );
 	    buffers[i].info.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
@@ -236,23 +585,98 @@ public:
 
 	    buffers[i].length = buffers[i].info.length;
 	    buffers[i].start = mmap( NULL, buffers[i].length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buffers[i].info.m.offset );
-	    if (MAP_FAILED == buffers[n_buffers].start)
+	    if (MAP_FAILED == buffers[i].start)
 		errno_exit( "mmap" );
         }
+	return( true );
+    }
+
+    // map_userptr - capture straight into count caller-owned buffers of length bytes,
+    // returns false (leaving the device unmapped) if the driver can't do it
+    bool map_userptr( void * const *ptrs, size_t length, int count )
+    {
+	long page = sysconf( _SC_PAGESIZE );
+	if (count > n_buffers) count = n_buffers;
+	if (count < 2 || length < size_t(bytesperframe())) return( false );
+	for (int i = 0; i < count; ++i)
+	    if (uintptr_t(ptrs[i]) & (page - 1))
+	    {
+		if (verbose) DBUG(( "userptr buffer %d is not page aligned", i ));
+		return( false );
+	    }
+
+        struct v4l2_requestbuffers req;
+        clear( req );
+        req.count               = count;
+        req.type                = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        req.memory              = V4L2_MEMORY_USERPTR;
+        if (-1 == xioctl( VIDIOC_REQBUFS, &req ))
+	{
+	    if (verbose) DBUG(( "%s does not support user pointers (%s)", dev_name, strerror( errno ) ));
+	    return( false );
+	}
+	// as for map(), but there are only count caller buffers to go round
+	if (int(req.count) < count) count = req.count;
+	if (count < 2)
+	{
+	    if (verbose) DBUG(( "%s only allows %d user pointer buffers", dev_name, req.count ));
+	    clear( req );
+	    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	    req.memory = V4L2_MEMORY_USERPTR;
+	    xioctl( VIDIOC_REQBUFS, &req ); // count 0 frees the queue
+	    return( false );
+	}
+
+	unmap();
+	memory = V4L2_MEMORY_USERPTR;
+	n_buffers = count;
+
+	// queue everything now, since some memory (e.g. VRAM apertures) can't be pinned
+	// and we only find that out when the driver tries
+	for (int i = 0; i < n_buffers; ++i)
+	{
+	    clear( buffers[i].info );
+	    buffers[i].info.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	    buffers[i].info.memory = V4L2_MEMORY_USERPTR;
+	    buffers[i].info.index = i;
+	    buffers[i].info.m.userptr = (unsigned long)ptrs[i];
+	    buffers[i].info.length = length;
+	    buffers[i].start = ptrs[i];
+	    buffers[i].length = length;
+
+	    if (-1 == xioctl( VIDIOC_QBUF, &buffers[i].info ))
+	    {
+		if (verbose) DBUG(( "VIDIOC_QBUF of user pointer failed (%s)", strerror( errno ) ));
+		unmap();
+		memory = V4L2_MEMORY_MMAP;
+		clear( req );
+		req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		req.memory = V4L2_MEMORY_USERPTR;
+		xioctl( VIDIOC_REQBUFS, &req ); // count 0 frees the queue
+		return( false );
+	    }
+	    buffers[i].queued = true;
+	}
+	if (verbose) DBUG(( "Capturing into %d user pointer buffers", n_buffers ));
+	return( true );
     }
 
     void start()
     {
 	for (int i = 0; i < n_buffers; ++i)
 	{
-	    if (buffers[i].length > 0)
+	    if (buffers[i].length > 0 && !buffers[i].queued)
 	    {
-		clear( buffers[i].info );
-		buffers[i].info.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-		buffers[i].info.memory = V4L2_MEMORY_MMAP;
-		buffers[i].info.index = i;
+		if (V4L2_MEMORY_MMAP == memory)
+		{
+		    clear( buffers[i].info );
+		    buffers[i].info.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		    buffers[i].info.memory = V4L2_MEMORY_MMAP;
+		    buffers[i].info.index = i;
+		}
 
 		if (-1 == xioctl( VIDIOC_QBUF, &buffers[i].info )) errno_exit( "VIDIOC_QBUF" );
+		buffers[i].queued = true;
 	    }
 	}
 	v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
@@ -263,56 +687,28 @@ public:
     {
 	v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 	if (-1 == xioctl( VIDIOC_STREAMOFF, &type )) errno_exit( "VIDIOC_STREAMOFF" );
-	// do we need to dequeue buffers here, or are they automatically dequeued?
+	// STREAMOFF implicitly dequeues every buffer
+	for (int i = 0; i < n_buffers; ++i) buffers[i].queued = false;
     }
 
-    bool wait()
+    // wait - wait up to timeout_ms for a frame to be ready
+    bool wait( int timeout_ms = 2000 )
     {
-	bool ready = false;
-	while (!ready)
-	{
-	    fd_set fds;
-	    FD_ZERO( &fds );
-	    FD_SET( fd, &fds );
-
-	    struct timeval tv;
-	    tv.tv_sec = 2;
-	    tv.tv_usec = 0;
-
-	    int r = select( fd + 1, &fds, NULL, NULL, &tv );
-
-	    if (-1 == r)
-	    {
-		if (EINTR == errno) continue;
-		errno_exit( "select" );
-	    }
-	    // timeout
-	    if (0 == r) break;
-
-	    ready = true;
-	}
-	return( ready );
+	return( poll_fd( timeout_ms, false ) );
     }
 
     int get()
     {
         struct v4l2_buffer buf;
-
-	clear( buf );
-	buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-	buf.memory = V4L2_MEMORY_MMAP;
-
-	if (-1 == xioctl( VIDIOC_DQBUF, &buf ))
-	{
-	    switch (errno)
-	    {
-	    case EAGAIN: return( -1 );
-	    case EIO: // (could ignore EIO, see spec) fall through...
-	    default: errno_exit( "VIDIOC_DQBUF" );
-	    }
-	}
-
-	if (buf.index >= n_buffers) FAIL(( "Buffer %d out of range 0..%d", buf.index, n_buffers ));
+	if (!dequeue( V4L2_BUF_TYPE_VIDEO_CAPTURE, memory, buf )) return( -1 );
+
+	if (int(buf.index) >= n_buffers) FAIL(( "Buffer %d out of range 0..%d", buf.index, n_buffers ));
+	buffers[buf.index].queued = false;
+	buffers[buf.index].used = buf.bytesused;
+	// only monotonic timestamps share a clock with now_ms()
+	buffers[buf.index].stamp = -1;
+	if (V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC == (buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK))
+	    buffers[buf.index].stamp = buf.timestamp.tv_sec * 1.0e3 + buf.timestamp.tv_usec * 1.0e-3;
 	return( buf.index );
     }
 
@@ -326,662 +722,6167 @@ public:
     {
 	if (i < 0 || i >= n_buffers) return;
 	if (-1 == xioctl( VIDIOC_QBUF, &buffers[i].info )) errno_exit( "VIDIOC_QBUF" );
+	buffers[i].queued = true;
     }
 };
 
 //
-// globals
+// vid_output - feed frames to a video output device, such as a v4l2loopback or vivid output
+//
+// The output side of vid_capture: buffers are mmap'd from the driver, filled
+// by the caller between get() and put(), and queued for whoever reads the
+// other end, with no copy beyond the one into the buffer.  get() hands out
+// the buffers that have never been queued first, then the ones the driver has
+// finished with, and never blocks: wait() does that.
 //
 
-static int scr_w = 640;
-static int scr_h = 480;
-static GLfloat vid_aspect, scr_aspect;
+class vid_output : public v4l2_device
+{
+private:
+    int			n_buffers;
+    struct buffer
+    {
+	void			*start;
+	size_t			length;
+	bool			queued;
+	struct v4l2_buffer	info;
+    };
+    buffer		*buffers;
+    int			n_fresh;		// buffers not yet queued even once
+    struct v4l2_format	fmt;
 
-static bool mirror = false;
-static bool showpoles = false;
-static bool animate_translation = false;
-static bool animate_translation_phase = false;
-static bool animate_iters = false;
-static bool dragging = false;
-static int drag_pt[2];
-static bool juliaing = false;
-static int julia_pt[2];
+public:
+    vid_output( int n_buffers = 4 ) : n_buffers(n_buffers), n_fresh(0)
+    {
+	buffers = new buffer[n_buffers];
+	clear( buffers[0], n_buffers );
+	clear( fmt );
+    }
 
-// mandelbrot center
-static GLfloat cx = 0;
-static GLfloat cy = -0.5;
-// julia seed point
+    ~vid_output()
+    {
+	unmap();
+	delete [] buffers;
+    }
+
+    // init - set the device up to take width x height frames in fourcc at fps
+    void init( int width, int height, uint32_t fourcc, double fps = 30 )
+    {
+        struct v4l2_capability cap;
+        if (-1 == xioctl( VIDIOC_QUERYCAP, &cap ))
+	{
+	    if (EINVAL == errno) FAIL(( "%s is not a linux video device", dev_name ));
+	    errno_exit( "VIDIOC_QUERYCAP" );
+        }
+	// a loopback device is both, and reports it in device_caps if it reports anything there
+	uint32_t caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS) ? cap.device_caps : cap.capabilities;
+        if (!(caps & V4L2_CAP_VIDEO_OUTPUT))
+	    FAIL(( "%s is not a linux video output device", dev_name ));
+	if (!(caps & V4L2_CAP_STREAMING))
+	    FAIL(( "%s does not support streaming I/O", dev_name ));
+
+        clear( fmt );
+        fmt.type                = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+        fmt.fmt.pix.width       = width;
+        fmt.fmt.pix.height      = height;
+        fmt.fmt.pix.pixelformat = fourcc;
+        fmt.fmt.pix.field       = V4L2_FIELD_NONE;
+	fmt.fmt.pix.colorspace  = V4L2_COLORSPACE_SMPTE170M;
+        if (-1 == xioctl( VIDIOC_S_FMT, &fmt )) errno_exit( "VIDIOC_S_FMT" );
+	if (fourcc != fmt.fmt.pix.pixelformat) FAIL(( "%s can't take %.4s", dev_name, (const char *)&fourcc ));
+	if (int(fmt.fmt.pix.width) != width || int(fmt.fmt.pix.height) != height)
+	    FAIL(( "%s can't take %dx%d frames (offers %dx%d)", dev_name, width, height, fmt.fmt.pix.width, fmt.fmt.pix.height ));
+
+        // buggy driver paranoia, as for capture
+	unsigned int min = width * ((V4L2_PIX_FMT_NV12 == fourcc) ? 1 : (V4L2_PIX_FMT_YUYV == fourcc) ? 2 : 3);
+	if (fmt.fmt.pix.bytesperline < min) fmt.fmt.pix.bytesperline = min;
+	min = fmt.fmt.pix.bytesperline * ((V4L2_PIX_FMT_NV12 == fourcc) ? height + height / 2 : height);
+	if (fmt.fmt.pix.sizeimage < min) fmt.fmt.pix.sizeimage = min;
+
+	// tell readers the frame rate, if the driver wants to know
+	struct v4l2_streamparm parm;
+	clear( parm );
+	parm.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+	if (fps > 0 && 0 == xioctl( VIDIOC_G_PARM, &parm ) && (parm.parm.output.capability & V4L2_CAP_TIMEPERFRAME))
+	{
+	    parm.parm.output.timeperframe.numerator = 1000;
+	    parm.parm.output.timeperframe.denominator = (unsigned)(fps * 1000 + 0.5);
+	    // ignore errors
+	    xioctl( VIDIOC_S_PARM, &parm );
+	}
+
+	if (verbose) DBUG(( "Ready to map output (%.4s %dx%d, %d bytes per line)", (const char *)&fourcc,
+	    fmt.fmt.pix.width, fmt.fmt.pix.height, fmt.fmt.pix.bytesperline ));
+    }
+
+    int width() { return( fmt.fmt.pix.width ); }
+    int height() { return( fmt.fmt.pix.height ); }
+    int bytesperline() { return( fmt.fmt.pix.bytesperline ); }
+    int bytesperframe() { return( fmt.fmt.pix.sizeimage ); }
+    int buffercount() { return( n_buffers ); }
+
+    void unmap()
+    {
+	for (int i = 0; i < n_buffers; ++i)
+	    if (buffers[i].length > 0)
+	    {
+		munmap( buffers[i].start, buffers[i].length );
+		buffers[i].start = NULL;
+		buffers[i].length = 0;
+		buffers[i].queued = false;
+	    }
+	n_fresh = 0;
+    }
+
+    bool map()
+    {
+        struct v4l2_requestbuffers req;
+
+        clear( req );
+	if (verbose) DBUG(( "Requesting %d output buffers", n_buffers ));
+        req.count               = n_buffers;
+        req.type                = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+        req.memory              = V4L2_MEMORY_MMAP;
+
+        if (-1 == xioctl( VIDIOC_REQBUFS, &req ))
+	{
+	    if (EINVAL == errno) FAIL(( "%s does not support memory mapping", dev_name ));
+	    errno_exit( "VIDIOC_REQBUFS" );
+        }
+        if (req.count < 2) FAIL(( "insufficient buffer memory on %s (%d buffers available)", dev_name, req.count ));
+
+	unmap();
+	if (int(req.count) < n_buffers) n_buffers = req.count;
+
+        for (int i = 0; i < n_buffers; ++i)
+	{
+	    clear( buffers[i].info );
+	    buffers[i].info.type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+	    buffers[i].info.memory = V4L2_MEMORY_MMAP;
+	    buffers[i].info.index = i;
+
+	    if (-1 == xioctl( VIDIOC_QUERYBUF, &buffers[i].info )) errno_exit( "VIDIOC_QUERYBUF" );
+	    if (buffers[i].info.length < unsigned(bytesperframe()))
+		FAIL(( "%s output buffer of %d bytes can't hold a %d byte frame", dev_name, buffers[i].info.length, bytesperframe() ));
+
+	    buffers[i].length = buffers[i].info.length;
+	    buffers[i].start = mmap( NULL, buffers[i].length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, buffers[i].info.m.offset );
+	    if (MAP_FAILED == buffers[i].start)
+		errno_exit( "mmap" );
+        }
+	n_fresh = n_buffers;
+	return( true );
+    }
+
+    // start - streaming only begins once a buffer is queued, so nothing is queued here
+    void start()
+    {
+	v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+	if (-1 == xioctl( VIDIOC_STREAMON, &type )) errno_exit( "VIDIOC_STREAMON" );
+    }
+
+    void stop()
+    {
+	v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_OUTPUT;
+	if (-1 == xioctl( VIDIOC_STREAMOFF, &type )) errno_exit( "VIDIOC_STREAMOFF" );
+	// STREAMOFF hands every buffer back to us
+	for (int i = 0; i < n_buffers; ++i) buffers[i].queued = false;
+	n_fresh = buffers[0].length ? n_buffers : 0;
+    }
+
+    // wait - wait up to timeout_ms for the driver to hand a buffer back
+    bool wait( int timeout_ms = 2000 )
+    {
+	return( n_fresh > 0 || poll_fd( timeout_ms, true ) );
+    }
+
+    // get - a buffer to fill, -1 if they are all queued
+    int get()
+    {
+	if (n_fresh > 0) return( n_buffers - n_fresh-- );
+
+        struct v4l2_buffer buf;
+	if (!dequeue( V4L2_BUF_TYPE_VIDEO_OUTPUT, V4L2_MEMORY_MMAP, buf )) return( -1 );
+
+	if (int(buf.index) >= n_buffers) FAIL(( "Buffer %d out of range 0..%d", buf.index, n_buffers ));
+	buffers[buf.index].queued = false;
+	return( buf.index );
+    }
+
+    void *data( int i )
+    {
+	if (i < 0 || i >= n_buffers) return( NULL );
+	return( buffers[i].start );
+    }
+
+    // put - queue a filled buffer for the reader, stamped now
+    void put( int i )
+    {
+	if (i < 0 || i >= n_buffers) return;
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	buffers[i].info.bytesused = bytesperframe();
+	buffers[i].info.field = V4L2_FIELD_NONE;
+	buffers[i].info.timestamp.tv_sec = ts.tv_sec;
+	buffers[i].info.timestamp.tv_usec = ts.tv_nsec / 1000;
+	if (-1 == xioctl( VIDIOC_QBUF, &buffers[i].info )) errno_exit( "VIDIOC_QBUF" );
+	buffers[i].queued = true;
+    }
+};
+
+//
+// file_source - play raw YUYV, NV12 or I420 frames, or MJPEG, from a file or pipe
+//
+// Regular files are mmap'd with MADV_SEQUENTIAL and the next few frames are
+// prefetched with MADV_WILLNEED as playback advances; frames are then handed
+// out straight from the mapping.  Pipes (and "-" for stdin) are read into the
+// buffers.  Frames come out in the file's own format, for a frame_converter
+// to turn into YUYV.  MJPEG (concatenated JPEG images, as from ffmpeg -f
+// mjpeg) has to come from a regular file, and its frame size from the first
+// image.  Playback is paced to fps, or runs as fast as it is consumed if fps
+// is 0, and regular files loop at the end.
+//
+
+class file_source : public frame_source
+{
+private:
+    int			fd;
+    char		*file_name;
+    uint32_t		fourcc;
+    int			w, h;
+    size_t		in_size;		// bytes per frame in the file, the largest seen for MJPEG
+    double		fps;
+    unsigned char	*map_base;		// whole file, when it could be mapped
+    size_t		map_len;
+    size_t		pos;
+    bool		eof;
+    double		next_due;		// now_ms() at which the next frame is due
+    int			n_buffers;
+    unsigned char	**bufs;			// frames read from a pipe
+    void		**ptrs;			// what data() returns for each buffer
+    size_t		*lens;			// and bytesused()
+    double		*stamps;		// and timestamp(), when each frame was due
+    bool		*busy;
+
+    static const int	READAHEAD_FRAMES = 4;
+
+    // read_frame - read a whole frame from a pipe, false at end of stream
+    bool read_frame( unsigned char *dst )
+    {
+	size_t got = 0;
+	while (got < in_size)
+	{
+	    ssize_t r = read( fd, dst + got, in_size - got );
+	    if (r < 0 && EINTR == errno) continue;
+	    if (r < 0) FAIL(( "read from %s failed (%s)", file_name, strerror( errno ) ));
+	    if (r == 0) return( false );
+	    got += r;
+	}
+	return( true );
+    }
+
+    // jpeg_length - bytes from the JPEG image at p up to the start of the next one
+    // (or the end of the file)
+    size_t jpeg_length( const unsigned char *p, size_t avail )
+    {
+	static const unsigned char soi[] = { 0xff, 0xd8, 0xff };
+	const unsigned char *next = avail > 3 ? (const unsigned char *)memmem( p + 3, avail - 3, soi, 3 ) : NULL;
+	return( next ? next - p : avail );
+    }
+
+    // next_mapped - pointer to the next frame in the map, looping at the end
+    const unsigned char *next_mapped( size_t &len )
+    {
+	bool mjpeg = (V4L2_PIX_FMT_MJPEG == fourcc);
+	if (pos + (mjpeg ? 4 : in_size) > map_len) pos = 0;
+	const unsigned char *frame = map_base + pos;
+	len = mjpeg ? jpeg_length( frame, map_len - pos ) : in_size;
+	if (len > in_size) in_size = len;
+	pos += len;
+
+	long page = sysconf( _SC_PAGESIZE );
+	size_t ra = pos & ~(page - 1);
+	size_t ra_len = in_size * READAHEAD_FRAMES;
+	if (ra + ra_len > map_len) ra_len = map_len - ra;
+	if (ra_len > 0) madvise( map_base + ra, ra_len, MADV_WILLNEED );
+	return( frame );
+    }
+
+    // jpeg_size - frame size from the header of a JPEG image, false if it isn't one
+    static bool jpeg_size( const unsigned char *p, size_t len, int &width, int &height )
+    {
+	for (size_t i = 2; i + 9 < len; )
+	{
+	    if (0xff != p[i]) return( false );
+	    unsigned char marker = p[i + 1];
+	    // SOF0..SOF15, except DHT, JPG and DAC which share the range
+	    if (marker >= 0xc0 && marker <= 0xcf && 0xc4 != marker && 0xc8 != marker && 0xcc != marker)
+	    {
+		height = (p[i + 5] << 8) | p[i + 6];
+		width = (p[i + 7] << 8) | p[i + 8];
+		return( true );
+	    }
+	    i += 2 + ((p[i + 2] << 8) | p[i + 3]);
+	}
+	return( false );
+    }
+
+public:
+    file_source( int n_buffers = 4 ) : fd(-1), file_name(NULL), fourcc(V4L2_PIX_FMT_YUYV), w(0), h(0), in_size(0), fps(0),
+	map_base(NULL), map_len(0), pos(0), eof(false), next_due(0), n_buffers(n_buffers)
+    {
+	bufs = new unsigned char *[n_buffers];
+	ptrs = new void *[n_buffers];
+	lens = new size_t[n_buffers];
+	stamps = new double[n_buffers];
+	busy = new bool[n_buffers];
+	for (int i = 0; i < n_buffers; ++i)
+	{
+	    bufs[i] = NULL;
+	    ptrs[i] = NULL;
+	    lens[i] = 0;
+	    stamps[i] = -1;
+	    busy[i] = false;
+	}
+    }
+
+    ~file_source()
+    {
+	for (int i = 0; i < n_buffers; ++i) delete [] bufs[i];
+	delete [] bufs;
+	delete [] ptrs;
+	delete [] lens;
+	delete [] stamps;
+	delete [] busy;
+	if (map_base) munmap( map_base, map_len );
+	if (fd > 0) close( fd );
+	delete [] file_name;
+    }
+
+    void open( const char *name, int width, int height, uint32_t pixelformat, double rate )
+    {
+	w = width & ~1;
+	h = height & ~1;
+	fourcc = pixelformat;
+	fps = rate;
+	in_size = (V4L2_PIX_FMT_YUYV == fourcc) ? size_t(w) * h * 2 : size_t(w) * h * 3 / 2;
+	if (V4L2_PIX_FMT_MJPEG == fourcc) in_size = 0;
+	else if (w <= 0 || h <= 0) FAIL(( "bad frame size %dx%d", width, height ));
+
+	if (!strcmp( name, "-" )) fd = 0;
+	else
+	{
+	    fd = ::open( name, O_RDONLY );
+	    if (-1 == fd) FAIL(( "failed to open %s", name ));
+	}
+	delete [] file_name;
+	file_name = new char[strlen( name ) + 1];
+	strcpy( file_name, name );
+
+	struct stat st;
+	if (-1 == fstat( fd, &st )) FAIL(( "%s: can't stat", name ));
+	if (S_ISREG( st.st_mode ))
+	{
+	    if (size_t(st.st_size) < in_size || 0 == st.st_size) FAIL(( "%s is smaller than one %dx%d frame", name, w, h ));
+	    map_len = st.st_size;
+	    map_base = (unsigned char *)mmap( NULL, map_len, PROT_READ, MAP_PRIVATE, fd, 0 );
+	    if (MAP_FAILED == map_base) FAIL(( "%s: mmap failed (%s)", name, strerror( errno ) ));
+	    madvise( map_base, map_len, MADV_SEQUENTIAL );
+	    if (verbose && in_size) DBUG(( "Mapped %s, %zu frames", name, map_len / in_size ));
+	}
+	else if (V4L2_PIX_FMT_MJPEG == fourcc) FAIL(( "%s: MJPEG can only be played from a regular file", name ));
+	else for (int i = 0; i < n_buffers; ++i) bufs[i] = new unsigned char[in_size];
+
+	if (V4L2_PIX_FMT_MJPEG == fourcc)
+	{
+	    if (!jpeg_size( map_base, map_len, width, height )) FAIL(( "%s doesn't start with a JPEG image", name ));
+	    w = width & ~1;
+	    h = height & ~1;
+	    if (verbose) DBUG(( "Mapped %s, %dx%d MJPEG", name, w, h ));
+	}
+    }
+
+    int width() { return( w ); }
+    int height() { return( h ); }
+    int bytesperline() { return( (V4L2_PIX_FMT_YUYV == fourcc) ? w * 2 : w ); }
+    int bytesperframe() { return( in_size ); }
+    int buffercount() { return( n_buffers ); }
+    uint32_t pixelformat() { return( fourcc ); }
+    size_t bytesused( int i ) { return( (i < 0 || i >= n_buffers) ? 0 : lens[i] ); }
+    double timestamp( int i ) { return( (i < 0 || i >= n_buffers) ? -1 : stamps[i] ); }
+
+    void start()
+    {
+	next_due = now_ms();
+    }
+
+    void stop()
+    {
+    }
+
+    bool wait( int timeout_ms = 2000 )
+    {
+	double delay = (eof || fps <= 0) ? 0 : next_due - now_ms();
+	if (eof) delay = timeout_ms;
+	if (delay > timeout_ms)
+	{
+	    usleep( timeout_ms * 1000 );
+	    return( false );
+	}
+	if (delay > 0) usleep( useconds_t(delay * 1000) );
+	return( !eof );
+    }
+
+    int get()
+    {
+	if (eof) return( -1 );
+	double now = now_ms();
+	if (fps > 0 && now < next_due) return( -1 );
+
+	int i;
+	for (i = 0; i < n_buffers && busy[i]; ++i) ;
+	if (i == n_buffers) return( -1 );
+
+	if (map_base) ptrs[i] = (void *)next_mapped( lens[i] );
+	else
+	{
+	    if (!read_frame( bufs[i] ))
+	    {
+		eof = true;
+		return( -1 );
+	    }
+	    ptrs[i] = bufs[i];
+	    lens[i] = in_size;
+	}
+
+	// a camera would have captured it when it was due
+	stamps[i] = (fps > 0) ? next_due : now;
+
+	// keep the schedule, but don't try to catch up after a stall
+	if (fps > 0)
+	{
+	    next_due += 1000.0 / fps;
+	    if (next_due < now) next_due = now;
+	}
+	busy[i] = true;
+	return( i );
+    }
+
+    void *data( int i )
+    {
+	if (i < 0 || i >= n_buffers) return( NULL );
+	return( ptrs[i] );
+    }
+
+    void release( int i )
+    {
+	if (i < 0 || i >= n_buffers) return;
+	busy[i] = false;
+    }
+};
+
+//
+// pattern_source - a fixed synthetic YUYV test card, for benchmarking without a camera
+//
+// The card has colour gradients, a checkerboard and a fine grating, so the
+// fractal pass samples texture with roughly the variety of real video.  A
+// frame is always ready, so every render pays for a full upload.
+//
+
+class pattern_source : public frame_source
+{
+private:
+    int			w, h;
+    unsigned char	*frame;
+    bool		busy;
+    double		stamp;
+
+public:
+    pattern_source( int width, int height ) : w(width & ~1), h(height & ~1), busy(false), stamp(-1)
+    {
+	if (w <= 0 || h <= 0) FAIL(( "bad frame size %dx%d", width, height ));
+	frame = new unsigned char[w * h * 2];
+	for (int y = 0; y < h; ++y)
+	{
+	    unsigned char *row = frame + y * w * 2;
+	    for (int x = 0; x < w; x += 2)
+	    {
+		bool check = ((x * 8 / w) ^ (y * 8 / h)) & 1;
+		bool fine = (y * 8 / h == 7) && (x & 2);
+		int luma = 16 + 219 * (x + y) / (w + h);
+		if (check) luma = 235 - (luma - 16);
+		if (fine) luma = 235;
+		row[2 * x + 0] = luma;
+		row[2 * x + 1] = 16 + 224 * x / w;		// U
+		row[2 * x + 2] = fine ? 16 : luma;
+		row[2 * x + 3] = 240 - 224 * y / h;		// V
+	    }
+	}
+    }
+
+    ~pattern_source()
+    {
+	delete [] frame;
+    }
+
+    int width() { return( w ); }
+    int height() { return( h ); }
+    int bytesperline() { return( w * 2 ); }
+    int bytesperframe() { return( w * h * 2 ); }
+    int buffercount() { return( 1 ); }
+
+    void start() {}
+    void stop() {}
+    bool wait( int timeout_ms = 2000 ) { return( true ); }
+    int get() { return( busy ? -1 : ((busy = true), (stamp = now_ms()), 0) ); }
+    void *data( int i ) { return( i ? NULL : frame ); }
+    double timestamp( int i ) { return( i ? -1 : stamp ); }
+    void release( int i ) { if (!i) busy = false; }
+};
+
+//
+// pack_yuyv - interleave a row of luma with a row of chroma pairs (UVUV..., as in NV12) into YUYV
+// pack_yuyv_planar - the same with separate U and V rows (I420, and JPEG's 4:2:x planes)
+//
+
+static void pack_yuyv( const unsigned char *y, const unsigned char *uv, unsigned char *dst, int w )
+{
+    int x = 0;
+    for (; x + 16 <= w; x += 16)
+    {
+	__m128i yy = _mm_loadu_si128( (const __m128i *)(y + x) );
+	__m128i cc = _mm_loadu_si128( (const __m128i *)(uv + x) );
+	_mm_storeu_si128( (__m128i *)(dst + 2 * x), _mm_unpacklo_epi8( yy, cc ) );
+	_mm_storeu_si128( (__m128i *)(dst + 2 * x + 16), _mm_unpackhi_epi8( yy, cc ) );
+    }
+    for (; x < w; ++x)
+    {
+	dst[2 * x] = y[x];
+	dst[2 * x + 1] = uv[x];
+    }
+}
+
+static void pack_yuyv_planar( const unsigned char *y, const unsigned char *u, const unsigned char *v, unsigned char *dst, int w )
+{
+    int x = 0;
+    for (; x + 16 <= w; x += 16)
+    {
+	__m128i yy = _mm_loadu_si128( (const __m128i *)(y + x) );
+	__m128i cc = _mm_unpacklo_epi8( _mm_loadl_epi64( (const __m128i *)(u + x / 2) ), _mm_loadl_epi64( (const __m128i *)(v + x / 2) ) );
+	_mm_storeu_si128( (__m128i *)(dst + 2 * x), _mm_unpacklo_epi8( yy, cc ) );
+	_mm_storeu_si128( (__m128i *)(dst + 2 * x + 16), _mm_unpackhi_epi8( yy, cc ) );
+    }
+    for (; x + 1 < w; x += 2)
+    {
+	dst[2 * x] = y[x];
+	dst[2 * x + 1] = u[x / 2];
+	dst[2 * x + 2] = y[x + 1];
+	dst[2 * x + 3] = v[x / 2];
+    }
+}
+
+//
+// yuyv_converter - turns single frames of some other pixel format into YUYV
+//
+// Nothing here converts colour: YUV->RGB stays in yuv_prog (or the cpu
+// renderer), so 4:2:0 only has its chroma rows doubled up and MJPEG is
+// decoded to its raw YCbCr planes without libjpeg's colour conversion or
+// fancy upsampling.  Each converter is only used by one thread at a time.
+//
+
+class yuyv_converter
+{
+public:
+    virtual ~yuyv_converter() {}
+    // convert - len bytes of frame at src to a YUYV frame at dst, false if it's unusable
+    virtual bool convert( const unsigned char *src, size_t len, unsigned char *dst ) = 0;
+    static yuyv_converter *create( uint32_t fourcc, int w, int h, int stride );
+};
+
+//
+// planar_converter - NV12 or I420 (YU12) to YUYV, with rows stride bytes apart
+//
+
+class planar_converter : public yuyv_converter
+{
+private:
+    bool		nv12;
+    int			w, h, stride;
+
+public:
+    planar_converter( uint32_t fourcc, int w, int h, int stride ) : nv12(V4L2_PIX_FMT_NV12 == fourcc), w(w), h(h), stride(stride)
+    {
+    }
+
+    bool convert( const unsigned char *src, size_t len, unsigned char *dst )
+    {
+	if (len < size_t(stride) * h * 3 / 2) return( false );
+	const unsigned char *cb = src + stride * h;
+	const unsigned char *cr = cb + (stride / 2) * (h / 2);
+	for (int y = 0; y < h; ++y, dst += w * 2)
+	{
+	    if (nv12) pack_yuyv( src + y * stride, cb + (y / 2) * stride, dst, w );
+	    else pack_yuyv_planar( src + y * stride, cb + (y / 2) * (stride / 2), cr + (y / 2) * (stride / 2), dst, w );
+	}
+	return( true );
+    }
+};
+
+//
+// mjpeg_converter - decode JPEG frames straight to YUYV
+//
+// libjpeg decodes the frame to its raw component planes, which the usual
+// camera 4:2:2 and 4:2:0 subsampling turns into YUYV rows with
+// pack_yuyv_planar; anything else takes the nearest chroma sample.  Corrupt
+// frames (common from USB cameras) longjmp back out and are dropped.
+//
+
+class mjpeg_converter : public yuyv_converter
+{
+private:
+    struct error_mgr
+    {
+	struct jpeg_error_mgr	pub;
+	jmp_buf			jump;
+    };
+
+    int			w, h;
+    struct jpeg_decompress_struct cinfo;
+    error_mgr		jerr;
+    unsigned char	*planes[3];
+    size_t		plane_size[3];
+    int			strides[3];
+
+    static void error_exit( j_common_ptr cinfo )
+    {
+	if (verbose) (*cinfo->err->output_message)( cinfo );
+	longjmp( ((error_mgr *)cinfo->err)->jump, 1 );
+    }
+
+    // warnings about corrupt data would otherwise go to stderr for every bad frame
+    static void output_message( j_common_ptr cinfo )
+    {
+	char text[JMSG_LENGTH_MAX];
+	(*cinfo->err->format_message)( cinfo, text );
+	if (verbose) DBUG(( "jpeg: %s", text ));
+    }
+
+public:
+    mjpeg_converter( int w, int h ) : w(w), h(h)
+    {
+	cinfo.err = jpeg_std_error( &jerr.pub );
+	jerr.pub.error_exit = error_exit;
+	jerr.pub.output_message = output_message;
+	jpeg_create_decompress( &cinfo );
+	for (int c = 0; c < 3; ++c)
+	{
+	    planes[c] = NULL;
+	    plane_size[c] = 0;
+	}
+    }
+
+    ~mjpeg_converter()
+    {
+	jpeg_destroy_decompress( &cinfo );
+	for (int c = 0; c < 3; ++c) delete [] planes[c];
+    }
+
+    bool convert( const unsigned char *src, size_t len, unsigned char *dst )
+    {
+	if (setjmp( jerr.jump ))
+	{
+	    jpeg_abort_decompress( &cinfo );
+	    return( false );
+	}
+
+	jpeg_mem_src( &cinfo, (unsigned char *)src, len );
+	jpeg_read_header( &cinfo, TRUE );
+	if (3 != cinfo.num_components || JCS_YCbCr != cinfo.jpeg_color_space || int(cinfo.image_width) < w || int(cinfo.image_height) < h)
+	{
+	    jpeg_abort_decompress( &cinfo );
+	    return( false );
+	}
+	cinfo.raw_data_out = TRUE;
+	cinfo.dct_method = JDCT_IFAST;
+	jpeg_start_decompress( &cinfo );
+
+	// room for whole iMCU rows of each component
+	int max_v = cinfo.max_v_samp_factor, max_h = cinfo.max_h_samp_factor;
+	for (int c = 0; c < 3; ++c)
+	{
+	    jpeg_component_info *comp = &cinfo.comp_info[c];
+	    strides[c] = comp->width_in_blocks * DCTSIZE;
+	    size_t size = size_t(strides[c]) * cinfo.total_iMCU_rows * comp->v_samp_factor * DCTSIZE;
+	    if (size > plane_size[c])
+	    {
+		delete [] planes[c];
+		planes[c] = new unsigned char[size];
+		plane_size[c] = size;
+	    }
+	}
+
+	JSAMPROW rows[3][4 * DCTSIZE];
+	JSAMPARRAY data[3] = { rows[0], rows[1], rows[2] };
+	while (cinfo.output_scanline < cinfo.output_height)
+	{
+	    int imcu = cinfo.output_scanline / (max_v * DCTSIZE);
+	    for (int c = 0; c < 3; ++c)
+	    {
+		int n = cinfo.comp_info[c].v_samp_factor * DCTSIZE;
+		for (int r = 0; r < n; ++r) rows[c][r] = planes[c] + size_t(imcu * n + r) * strides[c];
+	    }
+	    if (!jpeg_read_raw_data( &cinfo, data, max_v * DCTSIZE )) break;
+	}
+	jpeg_finish_decompress( &cinfo );
+
+	int hs[3], vs[3];
+	for (int c = 0; c < 3; ++c)
+	{
+	    hs[c] = cinfo.comp_info[c].h_samp_factor;
+	    vs[c] = cinfo.comp_info[c].v_samp_factor;
+	}
+	bool fast = (hs[0] == max_h && vs[0] == max_v && 2 * hs[1] == max_h && 2 * hs[2] == max_h);
+	// dst itself stays as it was at the setjmp(), which a longjmp() can't promise for a changed local
+	for (int y = 0; y < h; ++y)
+	{
+	    unsigned char *out = dst + size_t(y) * w * 2;
+	    const unsigned char *yr = planes[0] + size_t(y * vs[0] / max_v) * strides[0];
+	    const unsigned char *ur = planes[1] + size_t(y * vs[1] / max_v) * strides[1];
+	    const unsigned char *vr = planes[2] + size_t(y * vs[2] / max_v) * strides[2];
+	    if (fast) pack_yuyv_planar( yr, ur, vr, out, w );
+	    else for (int x = 0; x < w; x += 2)
+	    {
+		out[2 * x] = yr[x * hs[0] / max_h];
+		out[2 * x + 1] = ur[x * hs[1] / max_h];
+		out[2 * x + 2] = yr[(x + 1) * hs[0] / max_h];
+		out[2 * x + 3] = vr[x * hs[2] / max_h];
+	    }
+	}
+	return( true );
+    }
+};
+
+yuyv_converter *yuyv_converter::create( uint32_t fourcc, int w, int h, int stride )
+{
+    switch (fourcc)
+    {
+    case V4L2_PIX_FMT_NV12:
+    case V4L2_PIX_FMT_YUV420:
+	return( new planar_converter( fourcc, w, h, stride ) );
+    case V4L2_PIX_FMT_MJPEG:
+    case V4L2_PIX_FMT_JPEG:
+	return( new mjpeg_converter( w, h ) );
+    }
+    FAIL(( "no converter from %.4s to YUYV", (const char *)&fourcc ));
+    return( NULL );
+}
+
+//
+// frame_converter - a frame_source that converts another source's frames to YUYV
+//
+// Frames are converted on a few worker threads, each with its own
+// yuyv_converter, so decoding MJPEG keeps up with the camera even when one
+// frame takes longer than the frame interval.  Frames come out in the order
+// they were captured; the source's buffer goes back to it as soon as its
+// frame is converted, and only from the thread calling get() or wait(), so
+// with a capture_thread in front of it the device still has a single owner.
+// The source stays the caller's, so the device can be reconfigured and given
+// a new converter.
+//
+
+class frame_converter : public frame_source
+{
+private:
+    enum job_state { FREE, QUEUED, RUNNING, DONE, OUT };
+    struct job
+    {
+	job_state	state;
+	int		src_id;			// source buffer being converted, -1 once returned
+	unsigned	seq;			// capture order
+	double		stamp;			// the source's timestamp()
+	bool		ok;
+    };
+    struct worker_arg
+    {
+	frame_converter	*fc;
+	int		index;
+    };
+
+    frame_source	*src;
+    int			w, h;
+    int			n_bufs;
+    unsigned char	**bufs;			// YUYV frames, one per job
+    job			*jobs;
+    int			n_workers;
+    pthread_t		*threads;
+    worker_arg		*args;
+    yuyv_converter	**converters;
+    pthread_mutex_t	lock;
+    pthread_cond_t	work_cv;
+    pthread_cond_t	done_cv;
+    unsigned		next_seq;		// given to the next captured frame
+    unsigned		next_out;		// next frame to hand out
+    bool		quitting;
+    unsigned long	n_failed;
+
+    static void *worker( void *arg )
+    {
+	frame_converter *fc = ((worker_arg *)arg)->fc;
+	yuyv_converter *conv = fc->converters[((worker_arg *)arg)->index];
+
+	pthread_mutex_lock( &fc->lock );
+	for (;;)
+	{
+	    int j = -1;
+	    while (!fc->quitting && (j = fc->oldest( QUEUED )) < 0) pthread_cond_wait( &fc->work_cv, &fc->lock );
+	    if (fc->quitting) break;
+	    job &jb = fc->jobs[j];
+	    jb.state = RUNNING;
+	    pthread_mutex_unlock( &fc->lock );
+
+	    bool ok = conv->convert( (const unsigned char *)fc->src->data( jb.src_id ), fc->src->bytesused( jb.src_id ), fc->bufs[j] );
+
+	    pthread_mutex_lock( &fc->lock );
+	    jb.ok = ok;
+	    jb.state = DONE;
+	    pthread_cond_broadcast( &fc->done_cv );
+	}
+	pthread_mutex_unlock( &fc->lock );
+	return( NULL );
+    }
+
+    // oldest - job in the given state that was captured first, or -1 (lock held)
+    int oldest( job_state state )
+    {
+	int best = -1;
+	for (int j = 0; j < n_bufs; ++j)
+	    if (state == jobs[j].state && (best < 0 || int(jobs[j].seq - jobs[best].seq) < 0)) best = j;
+	return( best );
+    }
+
+    int count( job_state state )
+    {
+	int n = 0;
+	for (int j = 0; j < n_bufs; ++j) n += (state == jobs[j].state);
+	return( n );
+    }
+
+    // pump - return converted frames' buffers to the source and queue newly captured ones (lock held)
+    void pump()
+    {
+	for (int j = 0; j < n_bufs; ++j)
+	    if ((DONE == jobs[j].state || OUT == jobs[j].state) && jobs[j].src_id >= 0)
+	    {
+		src->release( jobs[j].src_id );
+		jobs[j].src_id = -1;
+	    }
+
+	int j, id;
+	while ((j = oldest( FREE )) >= 0 && (id = src->get()) >= 0)
+	{
+	    jobs[j].state = QUEUED;
+	    jobs[j].src_id = id;
+	    jobs[j].seq = next_seq++;
+	    jobs[j].stamp = src->timestamp( id );
+	    pthread_cond_signal( &work_cv );
+	}
+    }
+
+    // next_done - the job to hand out next if it's finished, or -1 (lock held)
+    int next_done()
+    {
+	for (int j = 0; j < n_bufs; ++j)
+	    if (DONE == jobs[j].state && jobs[j].seq == next_out) return( j );
+	return( -1 );
+    }
+
+public:
+    frame_converter( frame_source *src ) : src(src), w(src->width()), h(src->height()), next_seq(0), next_out(0), quitting(false), n_failed(0)
+    {
+	n_bufs = src->buffercount();
+	bufs = new unsigned char *[n_bufs];
+	jobs = new job[n_bufs];
+	for (int j = 0; j < n_bufs; ++j)
+	{
+	    bufs[j] = new unsigned char[w * h * 2];
+	    jobs[j].state = FREE;
+	    jobs[j].src_id = -1;
+	    jobs[j].seq = 0;
+	    jobs[j].stamp = -1;
+	    jobs[j].ok = false;
+	}
+
+	// one buffer is always with the renderer
+	n_workers = sysconf( _SC_NPROCESSORS_ONLN );
+	if (n_workers > n_bufs - 1) n_workers = n_bufs - 1;
+	if (n_workers < 1) n_workers = 1;
+
+	pthread_mutex_init( &lock, NULL );
+	pthread_cond_init( &work_cv, NULL );
+	pthread_cond_init( &done_cv, NULL );
+	converters = new yuyv_converter *[n_workers];
+	threads = new pthread_t[n_workers];
+	args = new worker_arg[n_workers];
+	for (int i = 0; i < n_workers; ++i)
+	{
+	    converters[i] = yuyv_converter::create( src->pixelformat(), w, h, src->bytesperline() );
+	    args[i].fc = this;
+	    args[i].index = i;
+	    if (pthread_create( &threads[i], NULL, worker, &args[i] )) FAIL(( "Can't create converter thread" ));
+	}
+	uint32_t fourcc = src->pixelformat();
+	if (verbose) DBUG(( "Converting %.4s to YUYV on %d threads", (const char *)&fourcc, n_workers ));
+    }
+
+    ~frame_converter()
+    {
+	pthread_mutex_lock( &lock );
+	quitting = true;
+	pthread_cond_broadcast( &work_cv );
+	pthread_mutex_unlock( &lock );
+	for (int i = 0; i < n_workers; ++i)
+	{
+	    pthread_join( threads[i], NULL );
+	    delete converters[i];
+	}
+	if (n_failed) DBUG(( "%lu unusable video frames dropped", n_failed ));
+	delete [] converters;
+	delete [] threads;
+	delete [] args;
+	for (int j = 0; j < n_bufs; ++j) delete [] bufs[j];
+	delete [] bufs;
+	delete [] jobs;
+	pthread_cond_destroy( &done_cv );
+	pthread_cond_destroy( &work_cv );
+	pthread_mutex_destroy( &lock );
+    }
+
+    frame_source *source() { return( src ); }
+
+    int width() { return( w ); }
+    int height() { return( h ); }
+    int bytesperline() { return( w * 2 ); }
+    int bytesperframe() { return( w * h * 2 ); }
+    int buffercount() { return( n_bufs ); }
+
+    void start()
+    {
+	src->start();
+    }
+
+    // stop - let conversions in flight finish and give everything not handed out back
+    void stop()
+    {
+	pthread_mutex_lock( &lock );
+	while (count( QUEUED ) + count( RUNNING ) > 0) pthread_cond_wait( &done_cv, &lock );
+	pump();
+	for (int j = 0; j < n_bufs; ++j)
+	    if (OUT != jobs[j].state)
+	    {
+		if (jobs[j].src_id >= 0) src->release( jobs[j].src_id );
+		jobs[j].src_id = -1;
+		jobs[j].state = FREE;
+	    }
+	next_out = next_seq;
+	pthread_mutex_unlock( &lock );
+	src->stop();
+    }
+
+    // wait - wait up to timeout_ms for the next frame in order to be converted
+    bool wait( int timeout_ms = 2000 )
+    {
+	double deadline = now_ms() + timeout_ms;
+	pthread_mutex_lock( &lock );
+	pump();
+	while (next_done() < 0)
+	{
+	    double left = deadline - now_ms();
+	    if (left <= 0) break;
+	    if (count( QUEUED ) + count( RUNNING ) > 0)
+	    {
+		struct timespec ts;
+		clock_gettime( CLOCK_REALTIME, &ts );
+		long long ns = ts.tv_nsec + (long long)(left * 1.0e6);
+		ts.tv_sec += ns / 1000000000;
+		ts.tv_nsec = ns % 1000000000;
+		pthread_cond_timedwait( &done_cv, &lock, &ts );
+	    }
+	    else
+	    {
+		// nothing in flight, and nowhere to put a new frame either
+		if (oldest( FREE ) < 0) break;
+		pthread_mutex_unlock( &lock );
+		bool ready = src->wait( int(left) );
+		pthread_mutex_lock( &lock );
+		if (!ready) break;
+	    }
+	    pump();
+	}
+	bool ready = (next_done() >= 0);
+	pthread_mutex_unlock( &lock );
+	return( ready );
+    }
+
+    int get()
+    {
+	pthread_mutex_lock( &lock );
+	pump();
+	int j;
+	while ((j = next_done()) >= 0 && !jobs[j].ok)
+	{
+	    // skip frames that failed to convert
+	    jobs[j].state = FREE;
+	    ++next_out;
+	    ++n_failed;
+	}
+	if (j >= 0)
+	{
+	    jobs[j].state = OUT;
+	    ++next_out;
+	}
+	pump();
+	pthread_mutex_unlock( &lock );
+	return( j );
+    }
+
+    void *data( int i )
+    {
+	if (i < 0 || i >= n_bufs) return( NULL );
+	return( bufs[i] );
+    }
+
+    double timestamp( int i ) { return( (i < 0 || i >= n_bufs) ? -1 : jobs[i].stamp ); }
+
+    void release( int i )
+    {
+	if (i < 0 || i >= n_bufs) return;
+	pthread_mutex_lock( &lock );
+	jobs[i].state = FREE;
+	pthread_mutex_unlock( &lock );
+    }
+};
+
+//
+// spsc_queue - bounded lock-free queue of ints with one producer and one consumer thread
+//
+
+class spsc_queue
+{
+private:
+    int			*slots;
+    unsigned		capacity;
+    unsigned		head;			// next slot to pop, written by the consumer
+    unsigned		tail;			// next slot to push, written by the producer
+
+public:
+    spsc_queue( int n ) : capacity(n), head(0), tail(0)
+    {
+	slots = new int[capacity];
+    }
+
+    ~spsc_queue()
+    {
+	delete [] slots;
+    }
+
+    bool push( int v )
+    {
+	unsigned t = __atomic_load_n( &tail, __ATOMIC_RELAXED );
+	if (t - __atomic_load_n( &head, __ATOMIC_ACQUIRE ) >= capacity) return( false );
+	slots[t % capacity] = v;
+	__atomic_store_n( &tail, t + 1, __ATOMIC_RELEASE );
+	return( true );
+    }
+
+    bool pop( int &v )
+    {
+	if (!peek( v )) return( false );
+	__atomic_store_n( &head, head + 1, __ATOMIC_RELEASE );
+	return( true );
+    }
+
+    // peek - what pop() would return, leaving it queued (consumer only)
+    bool peek( int &v )
+    {
+	unsigned h = __atomic_load_n( &head, __ATOMIC_RELAXED );
+	if (h == __atomic_load_n( &tail, __ATOMIC_ACQUIRE )) return( false );
+	v = slots[h % capacity];
+	return( true );
+    }
+
+    // size - how many are queued, exact from the consumer's side
+    int size()
+    {
+	return( __atomic_load_n( &tail, __ATOMIC_ACQUIRE ) - __atomic_load_n( &head, __ATOMIC_RELAXED ) );
+    }
+
+    int limit() { return( capacity ); }
+};
+
+//
+// capture_thread - dequeue video frames on their own thread so rendering never waits on the device
+//
+// How frames get from the capture thread to the renderer depends on the
+// queue policy:
+//
+// latest - the newest frame is published through a single slot that the
+//	renderer swaps out ("latest frame wins"): a frame that is replaced
+//	before the renderer gets to it is requeued and counted as dropped.
+//	Lowest latency, but the frame cadence jitters.
+// fifo - frames queue up and are all rendered in order.  The queue holds
+//	every buffer but the one being uploaded from, so it can't overflow: a
+//	source that is ahead of the renderer runs out of buffers and waits
+//	(files) or skips frames itself (cameras).  For recording.
+// paced - frames queue as for fifo, but the renderer shows them a steady
+//	delay after they were captured (the usual capture to dequeue lag plus
+//	a frame interval, both from the timestamps), skipping any it has fallen
+//	behind on.  The queue is two short of the buffers, so the device always
+//	has one to capture into and the capture timestamps stay steady.
+//	Smooth motion for a little more latency than latest.
+//
+// ready_depth() sizes the queue for the policy; latest only ever needs its slot.
+//
+// Frames the renderer has finished with come back through an spsc_queue and
+// are requeued by the capture thread, so only it ever touches the device.
+//
+
+// list of queue policy names
+#define LIST_QUEUE_POLICIES(_) \
+_(latest) \
+_(fifo) \
+_(paced)
+
+enum queue_policy
+{
+    #define MK_POLICY_ENUM(name) QUEUE_##name,
+    LIST_QUEUE_POLICIES(MK_POLICY_ENUM)
+    N_QUEUE_POLICIES
+};
+
+static queue_policy queue_policy_from_name( const char *name )
+{
+    #define MK_POLICY_MATCH(pname) if (!strcasecmp( name, #pname )) return( QUEUE_##pname );
+    LIST_QUEUE_POLICIES(MK_POLICY_MATCH)
+    return( N_QUEUE_POLICIES );
+}
+
+static const char *queue_policy_name( int policy )
+{
+    #define MK_POLICY_NAME(name) #name,
+    static const char *names[] = { LIST_QUEUE_POLICIES(MK_POLICY_NAME) };
+    return( (policy >= 0 && policy < N_QUEUE_POLICIES) ? names[policy] : "?" );
+}
+
+// ready_depth - how many of a source's buffers can wait for the renderer under policy
+static int ready_depth( queue_policy policy, int buffers )
+{
+    switch (policy)
+    {
+    case QUEUE_fifo: return( (buffers > 1) ? buffers - 1 : 1 );
+    case QUEUE_paced: return( (buffers > 3) ? buffers - 2 : 1 );
+    default: return( 1 );
+    }
+}
+
+class capture_thread
+{
+private:
+    frame_source	*src;
+    queue_policy	policy;
+    pthread_t		thread;
+    bool		running;
+    int			latest;			// newest undelivered buffer, or -1 (latest)
+    spsc_queue		ready;			// undelivered buffers in capture order (fifo, paced)
+    spsc_queue		returned;		// buffers the renderer has released
+    double		*dequeued;		// now_ms() when each buffer came off the source
+    unsigned long	n_captured;
+    unsigned long	n_dropped;
+    unsigned long	n_overflowed;		// of those, dropped for a full queue
+    unsigned long	n_delivered;
+    unsigned long	n_reused;
+    double		wait_ms;		// sum of the time delivered frames spent queued
+    unsigned long	depth_sum;		// sum of the frames waiting at each get()
+    unsigned long	n_gets;
+    double		last_stamp;		// paced: capture time of the last frame taken off the queue
+    double		interval_ms;		// paced: average time between captures
+    double		lag_ms;			// paced: average time from capture to dequeue
+    double		started;		// now_ms() at start()
+
+    void recycle()
+    {
+	int i;
+	while (returned.pop( i )) src->release( i );
+    }
+
+    // stamp - when frame i was captured, or failing that dequeued
+    double stamp( int i )
+    {
+	double t = src->timestamp( i );
+	return( (t < 0) ? dequeued[i] : t );
+    }
+
+    static void *run( void *arg )
+    {
+	capture_thread *ct = (capture_thread *)arg;
+	frame_source *src = ct->src;
+	while (__atomic_load_n( &ct->running, __ATOMIC_ACQUIRE ))
+	{
+	    ct->recycle();
+	    // short timeout so that stop() doesn't have to wait long
+	    if (!src->wait( 100 )) continue;
+
+	    // an unpaced file always has another frame, so keep checking for stop()
+	    int frameid;
+	    while (__atomic_load_n( &ct->running, __ATOMIC_ACQUIRE ) && (frameid = src->get()) >= 0)
+	    {
+		// published along with the frame by the exchange or push below
+		ct->dequeued[frameid] = now_ms();
+		__atomic_add_fetch( &ct->n_captured, 1, __ATOMIC_RELAXED );
+		if (QUEUE_latest == ct->policy)
+		{
+		    int old = __atomic_exchange_n( &ct->latest, frameid, __ATOMIC_ACQ_REL );
+		    if (old < 0) continue;
+		    src->release( old );
+		}
+		else
+		{
+		    if (ct->ready.push( frameid )) continue;
+		    src->release( frameid );
+		    __atomic_add_fetch( &ct->n_overflowed, 1, __ATOMIC_RELAXED );
+		}
+		__atomic_add_fetch( &ct->n_dropped, 1, __ATOMIC_RELAXED );
+	    }
+	}
+	return( NULL );
+    }
+
+    // take - pop the oldest queued frame, updating the pacing averages
+    int take()
+    {
+	int i;
+	if (!ready.pop( i )) return( -1 );
+	double t = stamp( i );
+	if (last_stamp > 0 && t > last_stamp)
+	    interval_ms = (interval_ms > 0) ? 0.9 * interval_ms + 0.1 * (t - last_stamp) : t - last_stamp;
+	lag_ms = 0.9 * lag_ms + 0.1 * (dequeued[i] - t);
+	last_stamp = t;
+	return( i );
+    }
+
+    // get_paced - the newest queued frame captured at least the pacing delay ago
+    int get_paced()
+    {
+	double due = now_ms() - (lag_ms + interval_ms);
+	int frameid = -1, next;
+	while (ready.peek( next ) && stamp( next ) <= due)
+	{
+	    if (frameid >= 0)
+	    {
+		release( frameid );
+		__atomic_add_fetch( &n_dropped, 1, __ATOMIC_RELAXED );
+	    }
+	    frameid = take();
+	}
+	// the queue filling up means the delay is too long, catch up a frame
+	if (frameid < 0 && ready.size() >= ready.limit()) frameid = take();
+	return( frameid );
+    }
+
+public:
+    capture_thread( frame_source *src, queue_policy policy = QUEUE_latest ) : src(src), policy(policy), running(false), latest(-1),
+	ready(ready_depth( policy, src->buffercount() )), returned(src->buffercount()), n_captured(0), n_dropped(0), n_overflowed(0),
+	n_delivered(0), n_reused(0), wait_ms(0), depth_sum(0), n_gets(0), last_stamp(0), interval_ms(0), lag_ms(0), started(0)
+    {
+	dequeued = new double[src->buffercount()];
+    }
+
+    ~capture_thread()
+    {
+	stop();
+	delete [] dequeued;
+    }
+
+    // continue_from - carry on the counts of the thread this one replaces
+    void continue_from( const capture_thread &prev )
+    {
+	n_captured = prev.n_captured;
+	n_dropped = prev.n_dropped;
+	n_overflowed = prev.n_overflowed;
+	n_delivered = prev.n_delivered;
+	n_reused = prev.n_reused;
+	wait_ms = prev.wait_ms;
+	depth_sum = prev.depth_sum;
+	n_gets = prev.n_gets;
+	started = prev.started;
+    }
+
+    void start()
+    {
+	if (running) return;
+	running = true;
+	if (!started) started = now_ms();
+	if (pthread_create( &thread, NULL, run, this )) FAIL(( "Can't create capture thread" ));
+    }
+
+    // stop - join the thread and give any undelivered frames back to the device
+    void stop()
+    {
+	if (!running) return;
+	__atomic_store_n( &running, false, __ATOMIC_RELEASE );
+	pthread_join( thread, NULL );
+	recycle();
+	int old = __atomic_exchange_n( &latest, -1, __ATOMIC_ACQ_REL );
+	if (old >= 0) src->release( old );
+	while (ready.pop( old )) src->release( old );
+    }
+
+    // get - take the next frame to render by the queue policy, or -1 to show
+    // the last one again (never blocks)
+    int get()
+    {
+	int frameid;
+	if (QUEUE_latest == policy)
+	{
+	    frameid = __atomic_exchange_n( &latest, -1, __ATOMIC_ACQ_REL );
+	    depth_sum += (frameid >= 0);
+	}
+	else
+	{
+	    depth_sum += ready.size();
+	    frameid = (QUEUE_paced == policy) ? get_paced() : take();
+	}
+	++n_gets;
+	if (frameid < 0) ++n_reused;
+	else
+	{
+	    ++n_delivered;
+	    wait_ms += now_ms() - dequeued[frameid];
+	}
+	return( frameid );
+    }
+
+    void *data( int i ) { return( src->data( i ) ); }
+
+    // release - hand a frame from get() back to the capture thread
+    void release( int i )
+    {
+	if (i < 0) return;
+	if (!returned.push( i )) FAIL(( "capture return queue overflow" ));
+    }
+
+    double timestamp( int i ) { return( src->timestamp( i ) ); }
+    double dequeue_time( int i ) { return( dequeued[i] ); }
+
+    queue_policy queuepolicy() { return( policy ); }
+    unsigned long captured() { return( __atomic_load_n( &n_captured, __ATOMIC_RELAXED ) ); }
+    unsigned long dropped() { return( __atomic_load_n( &n_dropped, __ATOMIC_RELAXED ) ); }
+    unsigned long reused() { return( n_reused ); }
+    // capture_fps - frames captured per second since start()
+    double capture_fps() { return( started ? captured() * 1000.0 / (now_ms() - started) : 0 ); }
+
+    void report( FILE *fp )
+    {
+	fprintf( fp, "%s queue of %d, %d buffers: %.2f fps, %lu frames captured, %lu rendered, %lu dropped (%lu to a full queue), %lu renders reused a frame,"
+	    " %.2f frames waiting and %.3f ms queued on average\n", queue_policy_name( policy ), (QUEUE_latest == policy) ? 1 : ready.limit(), src->buffercount(),
+	    capture_fps(), captured(), n_delivered, dropped(), __atomic_load_n( &n_overflowed, __ATOMIC_RELAXED ), n_reused,
+	    n_gets ? depth_sum / double(n_gets) : 0.0, n_delivered ? wait_ms / n_delivered : 0.0 );
+    }
+};
+
+//
+// thread_pool - fixed set of worker threads that run a job over a range of items
+//
+
+class thread_pool
+{
+public:
+    typedef void (*job_fn)( void *ctx, int item );
+
+private:
+    int			n_threads;
+    pthread_t		*threads;
+    pthread_mutex_t	lock;
+    pthread_cond_t	work_cv;
+    pthread_cond_t	done_cv;
+    job_fn		job;
+    void		*job_ctx;
+    int			n_items;
+    int			next_item;
+    int			n_busy;
+    unsigned		generation;
+    bool		quitting;
+
+    // run_items - pull items off the shared counter until there are none left
+    void run_items()
+    {
+	int i;
+	while ((i = __atomic_fetch_add( &next_item, 1, __ATOMIC_RELAXED )) < n_items)
+	    job( job_ctx, i );
+    }
+
+    static void *worker( void *arg )
+    {
+	thread_pool *pool = (thread_pool *)arg;
+	unsigned seen = 0;
+
+	pthread_mutex_lock( &pool->lock );
+	for (;;)
+	{
+	    while (!pool->quitting && pool->generation == seen)
+		pthread_cond_wait( &pool->work_cv, &pool->lock );
+	    if (pool->quitting) break;
+	    seen = pool->generation;
+	    pthread_mutex_unlock( &pool->lock );
+
+	    pool->run_items();
+
+	    pthread_mutex_lock( &pool->lock );
+	    if (0 == --pool->n_busy) pthread_cond_signal( &pool->done_cv );
+	}
+	pthread_mutex_unlock( &pool->lock );
+	return( NULL );
+    }
+
+public:
+    // n_threads counts the calling thread, 0 means one thread per online cpu
+    thread_pool( int n = 0 ) : n_threads(n), job(NULL), job_ctx(NULL), n_items(0), next_item(0), n_busy(0), generation(0), quitting(false)
+    {
+	if (n_threads <= 0) n_threads = sysconf( _SC_NPROCESSORS_ONLN );
+	if (n_threads <= 0) n_threads = 1;
+	pthread_mutex_init( &lock, NULL );
+	pthread_cond_init( &work_cv, NULL );
+	pthread_cond_init( &done_cv, NULL );
+	threads = new pthread_t[n_threads];
+	for (int i = 1; i < n_threads; ++i)
+	    if (pthread_create( &threads[i], NULL, worker, this )) FAIL(( "Can't create worker thread" ));
+	if (verbose) DBUG(( "Created thread_pool with %d threads", n_threads ));
+    }
+
+    ~thread_pool()
+    {
+	pthread_mutex_lock( &lock );
+	quitting = true;
+	pthread_cond_broadcast( &work_cv );
+	pthread_mutex_unlock( &lock );
+	for (int i = 1; i < n_threads; ++i) pthread_join( threads[i], NULL );
+	delete [] threads;
+	pthread_cond_destroy( &done_cv );
+	pthread_cond_destroy( &work_cv );
+	pthread_mutex_destroy( &lock );
+    }
+
+    int size() { return( n_threads ); }
+
+    // run - call fn( ctx, i ) for i in 0..count-1 across all threads, returns when done
+    void run( job_fn fn, void *ctx, int count )
+    {
+	pthread_mutex_lock( &lock );
+	job = fn;
+	job_ctx = ctx;
+	n_items = count;
+	next_item = 0;
+	n_busy = n_threads - 1;
+	++generation;
+	pthread_cond_broadcast( &work_cv );
+	pthread_mutex_unlock( &lock );
+
+	run_items();
+
+	pthread_mutex_lock( &lock );
+	while (n_busy > 0) pthread_cond_wait( &done_cv, &lock );
+	pthread_mutex_unlock( &lock );
+    }
+};
+
+//
+// deep_real - fixed point real with 192 fraction bits, for the deep zoom center
+//
+// Two's complement over 64 bit limbs, least significant first, with the top
+// limb holding the integer part.  Integer arithmetic so that -ffast-math
+// can't fold any of it away.  Reads as a double and takes doubles in
+// assignments, so the view code can keep treating cx and cy as plain numbers.
+//
+
+class deep_real
+{
+public:
+    static const int	LIMBS = 4;
+
+private:
+    uint64_t		v[LIMBS];
+
+    bool negative() const { return( int64_t(v[LIMBS - 1]) < 0 ); }
+
+    void negate()
+    {
+	uint64_t carry = 1;
+	for (int i = 0; i < LIMBS; ++i)
+	{
+	    v[i] = ~v[i] + carry;
+	    carry = carry && !v[i];
+	}
+    }
+
+public:
+    deep_real() { clear( v ); }
+    explicit deep_real( double d ) { *this = d; }
+
+    deep_real &operator=( double d )
+    {
+	bool neg = d < 0;
+	if (neg) d = -d;
+	// each step takes the next 64 bits off the top, exactly
+	for (int i = LIMBS - 1; i >= 0; --i)
+	{
+	    double f = floor( d );
+	    v[i] = uint64_t(f);
+	    d = (d - f) * 18446744073709551616.0;
+	}
+	if (neg) negate();
+	return( *this );
+    }
+
+    operator double() const
+    {
+	deep_real m = *this;
+	if (negative()) m.negate();
+	double d = 0;
+	for (int i = 0; i < LIMBS; ++i) d = d * (1.0 / 18446744073709551616.0) + double(m.v[i]);
+	return( negative() ? -d : d );
+    }
+
+    deep_real operator+( const deep_real &b ) const
+    {
+	deep_real r;
+	uint64_t carry = 0;
+	for (int i = 0; i < LIMBS; ++i)
+	{
+	    unsigned __int128 t = (unsigned __int128)v[i] + b.v[i] + carry;
+	    r.v[i] = uint64_t(t);
+	    carry = uint64_t(t >> 64);
+	}
+	return( r );
+    }
+
+    deep_real operator-() const { deep_real r = *this; r.negate(); return( r ); }
+    deep_real operator-( const deep_real &b ) const { return( *this + -b ); }
+
+    deep_real operator*( const deep_real &b ) const
+    {
+	deep_real x = *this, y = b;
+	bool neg = x.negative() != y.negative();
+	if (x.negative()) x.negate();
+	if (y.negative()) y.negate();
+	uint64_t prod[2 * LIMBS];
+	clear( prod );
+	for (int i = 0; i < LIMBS; ++i)
+	{
+	    uint64_t carry = 0;
+	    for (int j = 0; j < LIMBS; ++j)
+	    {
+		unsigned __int128 t = (unsigned __int128)x.v[i] * y.v[j] + prod[i + j] + carry;
+		prod[i + j] = uint64_t(t);
+		carry = uint64_t(t >> 64);
+	    }
+	    prod[i + LIMBS] = carry;
+	}
+	// drop the extra fraction limbs, anything past the integer limb overflowed
+	deep_real r;
+	for (int i = 0; i < LIMBS; ++i) r.v[i] = prod[i + LIMBS - 1];
+	if (neg) r.negate();
+	return( r );
+    }
+
+    deep_real &operator+=( double d ) { return( *this = *this + deep_real( d ) ); }
+    deep_real &operator-=( double d ) { return( *this = *this - deep_real( d ) ); }
+
+    // parse - read a decimal number at full precision, returns false if there isn't one
+    static bool parse( const char *s, deep_real &r, const char **end = NULL )
+    {
+	bool neg = ('-' == *s);
+	if ('-' == *s || '+' == *s) ++s;
+	if (!isdigit( *s ) && !('.' == *s && isdigit( s[1] ))) return( false );
+	uint64_t ip = 0;
+	while (isdigit( *s )) ip = ip * 10 + (*s++ - '0');
+	r = deep_real();
+	if ('.' == *s)
+	{
+	    const char *digits = ++s;
+	    while (isdigit( *s )) ++s;
+	    // fold the fraction digits in from the last one: f = (f + digit) / 10
+	    for (const char *d = s; d-- > digits;)
+	    {
+		unsigned __int128 rem = *d - '0';
+		for (int i = LIMBS - 2; i >= 0; --i)
+		{
+		    unsigned __int128 t = (rem << 64) | r.v[i];
+		    r.v[i] = uint64_t(t / 10);
+		    rem = t % 10;
+		}
+	    }
+	}
+	r.v[LIMBS - 1] = ip;
+	if (neg) r.negate();
+	if (end) *end = s;
+	return( true );
+    }
+};
+
+//
+// cpu_renderer - native SSE2/AVX2 implementation of yuv_prog and the fractal programs
+//
+// This is a reference for the GLSL path: the YUYV->RGB conversion reproduces
+// yuv_prog (including its chroma interpolation) bit-for-bit up to rounding, and
+// the fractal pass runs the same float orbit and the same shader trip count,
+// taking one bilinear sample of level 0 per iteration.
+//
+// Tolerance: with use_mipmaps turned off and -a 1, pixels whose orbit
+// stays bounded (|z| <= 2) match the GL path with a mean error under 0.5/255
+// and over 99% of them within 2/255 per channel.  The outliers sit on the set
+// boundary, and escaping orbits are chaotic in float, so a single ulp (FMA
+// contraction on the GPU is enough) can land them on a different texel; the
+// GL path also overflows those orbits to inf/nan, where the cpu clamps them.
+// With mipmaps on, the GL path additionally blurs wherever the orbit
+// minifies the video.
+//
+// With bailout on, escaped orbits take the average of the whole texture
+// where the GL path reads its last mip level (the same thing, up to the
+// box filter's rounding).  Against exact mode that costs a mean error of
+// about 10/255 at 16 iterations and 14/255 at 100 with the default radius.
+//
+
+struct cpu_params
+{
+    int			width, height;		// output size in pixels
+    float		left, dx;		// texcoord.x of the left edge, step per pixel
+    float		bottom, dy;		// texcoord.y of the bottom edge, step per row
+    float		tpx, tpy;		// trans_scale uniform
+    float		jx, jy;			// julia seed
+    bool		julia;
+    bool		poles;
+    bool		mirror;
+    int			trips;			// shader loop trip count
+    float		iter_scale;
+    float		bailout;		// squared escape radius, 0 to always fetch
+    bool		deep;			// perturb around orbit, see span_deep()
+    const double	*orbit;			// reference orbit, hi x, y and lo x, y per entry
+    int			orbit_len;
+    double		deep_left, deep_dx;	// texcoord.x offset from the center at the left edge, step per pixel
+    double		deep_bottom, deep_dy;	// likewise for texcoord.y
+};
+
+class cpu_renderer
+{
+private:
+    thread_pool		*pool;
+    bool		has_avx2;
+    int			tex_w, tex_h;
+    uint32_t		*tex;			// RGBA8 copy of rgb_tex
+    int			out_w, out_h;
+    uint32_t		*out;			// RGBA8 output, bottom row first
+    float		vid_aspect;
+    bool		mean_valid;		// mean holds the texture's average colour
+    float		mean[3];
+    unsigned long	n_fetches;		// bilinear fetches in the last render
+
+    // work description shared with the pool during convert/render
+    const unsigned char	*src;
+    int			src_pitch;
+    cpu_params		params;
+
+    static const int	TILE_W = 64;
+    static const int	TILE_H = 16;
+    // orbits are clamped here so that they never overflow into inf/nan
+    static const float	ORBIT_LIMIT;
+
+    static inline uint8_t to_u8( float x )
+    {
+	x = x * 255.0f + 0.5f;
+	return( (x <= 0) ? 0 : (x >= 255) ? 255 : uint8_t(x) );
+    }
+
+    // convert_row - yuv_prog for one row: Y from the macropixel, UV blended 3:1 with the neighbour
+    void convert_row( int y )
+    {
+	const unsigned char *row = src + y * src_pitch;
+	uint32_t *dst = tex + y * tex_w;
+	int n_mp = tex_w / 2;
+	for (int x = 0; x < tex_w; ++x)
+	{
+	    int k = x >> 1;
+	    int k2 = (x & 1) ? ((k + 1 < n_mp) ? k + 1 : k) : ((k > 0) ? k - 1 : k);
+	    const unsigned char *mp = row + 4 * k;
+	    const unsigned char *mp2 = row + 4 * k2;
+	    float y8 = (x & 1) ? mp[2] : mp[0];
+	    float u = (0.75f * mp[1] + 0.25f * mp2[1]) * (1.0f / 255.0f) - 0.5f;
+	    float v = (0.75f * mp[3] + 0.25f * mp2[3]) * (1.0f / 255.0f) - 0.5f;
+	    float yy = 1.1643f * (y8 * (1.0f / 255.0f) - 0.0625f);
+	    float r = yy + 1.5958f * v;
+	    float g = yy - 0.39173f * u - 0.81290f * v;
+	    float b = yy + 2.017f * u;
+	    dst[x] = to_u8( r ) | (to_u8( g ) << 8) | (to_u8( b ) << 16) | 0xff000000u;
+	}
+    }
+
+    static void convert_job( void *ctx, int y ) { ((cpu_renderer *)ctx)->convert_row( y ); }
+
+    // span_* - render n pixels of row y into dst, returning the texture fetches made
+    int span_sse2( int x, int y, int n, uint32_t *dst );
+    int span_avx2( int x, int y, int n, uint32_t *dst );
+    int span_deep( int x, int y, int n, uint32_t *dst );
+
+    // sample - bilinear fetch of level 0 at s, t, with the same wrapping as coord_sse2()
+    void sample( float s, float t, float rgb[3] ) const
+    {
+	int i[2], j[2];
+	float wx, wy;
+	coord( s, tex_w, params.mirror, i, wx );
+	coord( t, tex_h, params.mirror, j, wy );
+	for (int c = 0; c < 3; ++c)
+	{
+	    int sh = 8 * c;
+	    float c00 = (tex[j[0] * tex_w + i[0]] >> sh) & 0xff, c10 = (tex[j[0] * tex_w + i[1]] >> sh) & 0xff;
+	    float c01 = (tex[j[1] * tex_w + i[0]] >> sh) & 0xff, c11 = (tex[j[1] * tex_w + i[1]] >> sh) & 0xff;
+	    float top = c00 + (c10 - c00) * wx, bot = c01 + (c11 - c01) * wx;
+	    rgb[c] = top + (bot - top) * wy;
+	}
+    }
+
+    static void coord( float s, int size, bool mirror, int i[2], float &w )
+    {
+	s = mirror ? s - 2.0f * floorf( s * 0.5f ) : s - floorf( s );
+	float u = s * size - 0.5f;
+	float fu = floorf( u );
+	w = u - fu;
+	int period = mirror ? 2 * size : size;
+	for (int k = 0; k < 2; ++k)
+	{
+	    int n = int(fu) + k;
+	    if (n < 0) n += period;
+	    if (n >= period) n -= period;
+	    i[k] = (mirror && n > size - 1) ? period - 1 - n : n;
+	}
+    }
+
+    void render_tile( int tile )
+    {
+	int tiles_x = (out_w + TILE_W - 1) / TILE_W;
+	int x0 = (tile % tiles_x) * TILE_W;
+	int y0 = (tile / tiles_x) * TILE_H;
+	int w = (x0 + TILE_W <= out_w) ? TILE_W : out_w - x0;
+	int y1 = (y0 + TILE_H <= out_h) ? y0 + TILE_H : out_h;
+	unsigned long fetches = 0;
+	for (int y = y0; y < y1; ++y)
+	{
+	    if (params.deep) fetches += span_deep( x0, y, w, out + y * out_w + x0 );
+	    else if (has_avx2) fetches += span_avx2( x0, y, w, out + y * out_w + x0 );
+	    else fetches += span_sse2( x0, y, w, out + y * out_w + x0 );
+	}
+	__atomic_fetch_add( &n_fetches, fetches, __ATOMIC_RELAXED );
+    }
+
+    // compute_mean - average colour of the texture, what escaped orbits alias down to
+    void compute_mean()
+    {
+	double sum[3] = { 0, 0, 0 };
+	for (int i = 0; i < tex_w * tex_h; ++i)
+	{
+	    sum[0] += tex[i] & 0xff;
+	    sum[1] += (tex[i] >> 8) & 0xff;
+	    sum[2] += (tex[i] >> 16) & 0xff;
+	}
+	for (int c = 0; c < 3; ++c) mean[c] = float(sum[c] / (tex_w * tex_h));
+	mean_valid = true;
+    }
+
+    static void render_job( void *ctx, int tile ) { ((cpu_renderer *)ctx)->render_tile( tile ); }
+
+public:
+    cpu_renderer( int n_threads = 0 ) : tex_w(0), tex_h(0), tex(NULL), out_w(0), out_h(0), out(NULL), vid_aspect(1), mean_valid(false), n_fetches(0), src(NULL), src_pitch(0)
+    {
+	pool = new thread_pool( n_threads );
+	__builtin_cpu_init();
+	has_avx2 = __builtin_cpu_supports( "avx2" );
+	clear( params );
+	if (verbose) DBUG(( "cpu_renderer using %s with %d threads", has_avx2 ? "AVX2" : "SSE2", pool->size() ));
+    }
+
+    ~cpu_renderer()
+    {
+	delete pool;
+	free( tex );
+	free( out );
+    }
+
+    const char *isa() { return( has_avx2 ? "avx2" : "sse2" ); }
+    int threads() { return( pool->size() ); }
+    const uint32_t *pixels() { return( out ); }
+    const uint32_t *texels() { return( tex ); }
+    // fetches - average bilinear fetches per pixel in the last render
+    float fetches() { return( (out_w && out_h) ? float(n_fetches) / (out_w * out_h) : 0 ); }
+
+    // load_yuyv - convert a YUYV frame into the internal RGB texture
+    void load_yuyv( const void *data, int width, int height, int pitch )
+    {
+	if (width != tex_w || height != tex_h)
+	{
+	    free( tex );
+	    tex_w = width;
+	    tex_h = height;
+	    tex = (uint32_t *)aligned_alloc( 64, ((sizeof(uint32_t) * tex_w * tex_h) + 63) & ~63 );
+	    if (!tex) FAIL(( "Can't allocate %dx%d cpu texture", tex_w, tex_h ));
+	    vid_aspect = tex_w / float(tex_h);
+	}
+	src = (const unsigned char *)data;
+	src_pitch = pitch;
+	pool->run( convert_job, this, tex_h );
+	mean_valid = false;
+    }
+
+    // render - run the fractal pass into a width x height RGBA8 image
+    const uint32_t *render( const cpu_params &p )
+    {
+	if (p.width != out_w || p.height != out_h)
+	{
+	    free( out );
+	    out_w = p.width;
+	    out_h = p.height;
+	    out = (uint32_t *)aligned_alloc( 64, ((sizeof(uint32_t) * out_w * out_h) + 63) & ~63 );
+	    if (!out) FAIL(( "Can't allocate %dx%d cpu frame", out_w, out_h ));
+	}
+	if (!tex && !p.poles) return( out );
+	if (p.bailout > 0 && !p.poles && !mean_valid) compute_mean();
+	params = p;
+	n_fetches = 0;
+	int tiles = ((out_w + TILE_W - 1) / TILE_W) * ((out_h + TILE_H - 1) / TILE_H);
+	pool->run( render_job, this, tiles );
+	return( out );
+    }
+};
+
+const float cpu_renderer::ORBIT_LIMIT = 1e16f;
+
+//
+// sse2 kernel - 4 lanes, texel fetches done with scalar loads
+//
+
+static inline __m128 floor_sse2( __m128 x )
+{
+    // truncate, step down for negatives, and pass through values that are already integral
+    __m128 big = _mm_cmpge_ps( _mm_andnot_ps( _mm_set1_ps( -0.0f ), x ), _mm_set1_ps( 8388608.0f ) );
+    __m128 t = _mm_cvtepi32_ps( _mm_cvttps_epi32( x ) );
+    t = _mm_sub_ps( t, _mm_and_ps( _mm_cmpgt_ps( t, x ), _mm_set1_ps( 1.0f ) ) );
+    return( _mm_or_ps( _mm_and_ps( big, x ), _mm_andnot_ps( big, t ) ) );
+}
+
+// wrap_sse2 - map texel indices in -1..period into 0..size-1 for REPEAT or MIRRORED_REPEAT
+static inline __m128i wrap_sse2( __m128i i, int size, bool mirror )
+{
+    int period = mirror ? 2 * size : size;
+    __m128i p = _mm_set1_epi32( period );
+    i = _mm_add_epi32( i, _mm_and_si128( _mm_cmplt_epi32( i, _mm_setzero_si128() ), p ) );
+    i = _mm_sub_epi32( i, _mm_andnot_si128( _mm_cmplt_epi32( i, p ), p ) );
+    if (mirror)
+    {
+	__m128i hi = _mm_cmpgt_epi32( i, _mm_set1_epi32( size - 1 ) );
+	__m128i m = _mm_sub_epi32( _mm_set1_epi32( period - 1 ), i );
+	i = _mm_or_si128( _mm_and_si128( hi, m ), _mm_andnot_si128( hi, i ) );
+    }
+    return( i );
+}
+
+// coord_sse2 - wrap a texture coordinate and split it into two texel indices and a weight
+static inline void coord_sse2( __m128 s, int size, bool mirror, __m128i &i0, __m128i &i1, __m128 &w )
+{
+    if (mirror) s = _mm_sub_ps( s, _mm_mul_ps( _mm_set1_ps( 2.0f ), floor_sse2( _mm_mul_ps( s, _mm_set1_ps( 0.5f ) ) ) ) );
+    else s = _mm_sub_ps( s, floor_sse2( s ) );
+    __m128 u = _mm_sub_ps( _mm_mul_ps( s, _mm_set1_ps( float(size) ) ), _mm_set1_ps( 0.5f ) );
+    __m128 fu = floor_sse2( u );
+    w = _mm_sub_ps( u, fu );
+    __m128i i = _mm_cvttps_epi32( fu );
+    i0 = wrap_sse2( i, size, mirror );
+    i1 = wrap_sse2( _mm_add_epi32( i, _mm_set1_epi32( 1 ) ), size, mirror );
+}
+
+static inline void unpack_sse2( __m128i c, __m128 &r, __m128 &g, __m128 &b )
+{
+    __m128i m = _mm_set1_epi32( 0xff );
+    r = _mm_cvtepi32_ps( _mm_and_si128( c, m ) );
+    g = _mm_cvtepi32_ps( _mm_and_si128( _mm_srli_epi32( c, 8 ), m ) );
+    b = _mm_cvtepi32_ps( _mm_and_si128( _mm_srli_epi32( c, 16 ), m ) );
+}
+
+static inline __m128 lerp_sse2( __m128 a, __m128 b, __m128 w )
+{
+    return( _mm_add_ps( a, _mm_mul_ps( _mm_sub_ps( b, a ), w ) ) );
+}
+
+static inline __m128i pack_sse2( __m128 r, __m128 g, __m128 b )
+{
+    __m128 lo = _mm_setzero_ps();
+    __m128 hi = _mm_set1_ps( 255.0f );
+    __m128i ir = _mm_cvtps_epi32( _mm_min_ps( _mm_max_ps( r, lo ), hi ) );
+    __m128i ig = _mm_cvtps_epi32( _mm_min_ps( _mm_max_ps( g, lo ), hi ) );
+    __m128i ib = _mm_cvtps_epi32( _mm_min_ps( _mm_max_ps( b, lo ), hi ) );
+    __m128i c = _mm_or_si128( ir, _mm_slli_epi32( ig, 8 ) );
+    c = _mm_or_si128( c, _mm_slli_epi32( ib, 16 ) );
+    return( _mm_or_si128( c, _mm_set1_epi32( 0xff000000 ) ) );
+}
+
+int cpu_renderer::span_sse2( int x, int y, int n, uint32_t *dst )
+{
+    const cpu_params &p = params;
+    const __m128 bail = _mm_set1_ps( p.bailout );
+    int fetches = 0;
+    const __m128 lim = _mm_set1_ps( ORBIT_LIMIT );
+    const __m128 nlim = _mm_set1_ps( -ORBIT_LIMIT );
+    const __m128 half = _mm_set1_ps( 0.5f );
+    const __m128 aspect = _mm_set1_ps( vid_aspect );
+    const __m128 ty = _mm_set1_ps( p.bottom + (y + 0.5f) * p.dy );
+
+    for (int i = 0; i < n; i += 4)
+    {
+	__m128 lane = _mm_add_ps( _mm_set_ps( 3, 2, 1, 0 ), _mm_set1_ps( float(x + i) + 0.5f ) );
+	__m128 tx = _mm_add_ps( _mm_set1_ps( p.left ), _mm_mul_ps( lane, _mm_set1_ps( p.dx ) ) );
+
+	// p = gl_TexCoord[0].yx
+	__m128 px = ty, py = tx;
+	__m128 cx = p.julia ? _mm_set1_ps( p.tpx * p.jx ) : _mm_mul_ps( _mm_set1_ps( p.tpx ), px );
+	__m128 cy = p.julia ? _mm_set1_ps( p.tpy * p.jy ) : _mm_mul_ps( _mm_set1_ps( p.tpy ), py );
+	__m128 ar = _mm_setzero_ps(), ag = _mm_setzero_ps(), ab = _mm_setzero_ps();
+	// lanes still fetching: not past the end of the span, and not escaped
+	int live = (n - i >= 4) ? 0xf : (1 << (n - i)) - 1;
+
+	for (int k = 0; k < p.trips; ++k)
+	{
+	    __m128 nx = _mm_add_ps( _mm_sub_ps( _mm_mul_ps( px, px ), _mm_mul_ps( py, py ) ), cx );
+	    __m128 ny = _mm_add_ps( _mm_mul_ps( _mm_add_ps( px, px ), py ), cy );
+	    // min/max return the limit for nans, so the orbit stays finite
+	    px = _mm_max_ps( _mm_min_ps( nx, lim ), nlim );
+	    py = _mm_max_ps( _mm_min_ps( ny, lim ), nlim );
+	    if (p.poles) continue;
+
+	    if (p.bailout > 0)
+	    {
+		// escaped lanes take the mean colour for all their remaining trips
+		int esc = live & _mm_movemask_ps( _mm_cmpgt_ps( _mm_add_ps( _mm_mul_ps( px, px ), _mm_mul_ps( py, py ) ), bail ) );
+		if (esc)
+		{
+		    __m128 m = _mm_and_ps( _mm_castsi128_ps( _mm_cmpgt_epi32( _mm_and_si128( _mm_set1_epi32( esc ), _mm_set_epi32( 8, 4, 2, 1 ) ), _mm_setzero_si128() ) ),
+					   _mm_set1_ps( float(p.trips - k) ) );
+		    ar = _mm_add_ps( ar, _mm_mul_ps( m, _mm_set1_ps( mean[0] ) ) );
+		    ag = _mm_add_ps( ag, _mm_mul_ps( m, _mm_set1_ps( mean[1] ) ) );
+		    ab = _mm_add_ps( ab, _mm_mul_ps( m, _mm_set1_ps( mean[2] ) ) );
+		    fetches += __builtin_popcount( esc );
+		    live &= ~esc;
+		    if (!live) break;
+		}
+	    }
+	    fetches += __builtin_popcount( live );
+
+	    __m128i i0, i1, j0, j1;
+	    __m128 wx, wy;
+	    coord_sse2( _mm_add_ps( py, half ), tex_w, p.mirror, i0, i1, wx );
+	    coord_sse2( _mm_add_ps( _mm_mul_ps( px, aspect ), half ), tex_h, p.mirror, j0, j1, wy );
+
+	    int ai0[4], ai1[4], aj0[4], aj1[4];
+	    _mm_storeu_si128( (__m128i *)ai0, i0 );
+	    _mm_storeu_si128( (__m128i *)ai1, i1 );
+	    _mm_storeu_si128( (__m128i *)aj0, j0 );
+	    _mm_storeu_si128( (__m128i *)aj1, j1 );
+	    uint32_t c00[4], c10[4], c01[4], c11[4];
+	    for (int l = 0; l < 4; ++l)
+	    {
+		if (!(live & (1 << l)))
+		{
+		    c00[l] = c10[l] = c01[l] = c11[l] = 0;
+		    continue;
+		}
+		const uint32_t *r0 = tex + aj0[l] * tex_w;
+		const uint32_t *r1 = tex + aj1[l] * tex_w;
+		c00[l] = r0[ai0[l]];
+		c10[l] = r0[ai1[l]];
+		c01[l] = r1[ai0[l]];
+		c11[l] = r1[ai1[l]];
+	    }
+
+	    __m128 r00, g00, b00, r10, g10, b10, r01, g01, b01, r11, g11, b11;
+	    unpack_sse2( _mm_loadu_si128( (__m128i *)c00 ), r00, g00, b00 );
+	    unpack_sse2( _mm_loadu_si128( (__m128i *)c10 ), r10, g10, b10 );
+	    unpack_sse2( _mm_loadu_si128( (__m128i *)c01 ), r01, g01, b01 );
+	    unpack_sse2( _mm_loadu_si128( (__m128i *)c11 ), r11, g11, b11 );
+	    ar = _mm_add_ps( ar, lerp_sse2( lerp_sse2( r00, r10, wx ), lerp_sse2( r01, r11, wx ), wy ) );
+	    ag = _mm_add_ps( ag, lerp_sse2( lerp_sse2( g00, g10, wx ), lerp_sse2( g01, g11, wx ), wy ) );
+	    ab = _mm_add_ps( ab, lerp_sse2( lerp_sse2( b00, b10, wx ), lerp_sse2( b01, b11, wx ), wy ) );
+	}
+
+	__m128i c;
+	if (p.poles)
+	{
+	    // rg = 0.5 * (p / |p| + 1), b = min( |p|, 1 / |p| )
+	    __m128 len = _mm_sqrt_ps( _mm_add_ps( _mm_mul_ps( px, px ), _mm_mul_ps( py, py ) ) );
+	    __m128 nz = _mm_cmpgt_ps( len, _mm_setzero_ps() );
+	    __m128 rl = _mm_and_ps( nz, _mm_div_ps( _mm_set1_ps( 1.0f ), len ) );
+	    __m128 blue = _mm_min_ps( rl, len );
+	    __m128 s = _mm_set1_ps( 127.5f );
+	    c = pack_sse2( _mm_mul_ps( _mm_add_ps( _mm_mul_ps( px, rl ), _mm_set1_ps( 1.0f ) ), s ),
+			   _mm_mul_ps( _mm_add_ps( _mm_mul_ps( py, rl ), _mm_set1_ps( 1.0f ) ), s ),
+			   _mm_mul_ps( blue, _mm_set1_ps( 255.0f ) ) );
+	}
+	else
+	{
+	    __m128 sc = _mm_set1_ps( p.iter_scale );
+	    c = pack_sse2( _mm_mul_ps( ar, sc ), _mm_mul_ps( ag, sc ), _mm_mul_ps( ab, sc ) );
+	}
+
+	if (i + 4 <= n) _mm_storeu_si128( (__m128i *)(dst + i), c );
+	else
+	{
+	    uint32_t tmp[4];
+	    _mm_storeu_si128( (__m128i *)tmp, c );
+	    for (int l = 0; i + l < n; ++l) dst[i + l] = tmp[l];
+	}
+    }
+    return( fetches );
+}
+
+//
+// avx2 kernel - 8 lanes with gathered texel fetches (no fma, so it tracks the sse2 orbit exactly)
+//
+
+#define AVX2_FN __attribute__((target("avx2")))
+
+AVX2_FN static inline __m256i wrap_avx2( __m256i i, int size, bool mirror )
+{
+    int period = mirror ? 2 * size : size;
+    __m256i p = _mm256_set1_epi32( period );
+    i = _mm256_add_epi32( i, _mm256_and_si256( _mm256_cmpgt_epi32( _mm256_setzero_si256(), i ), p ) );
+    i = _mm256_sub_epi32( i, _mm256_andnot_si256( _mm256_cmpgt_epi32( p, i ), p ) );
+    if (mirror)
+    {
+	__m256i hi = _mm256_cmpgt_epi32( i, _mm256_set1_epi32( size - 1 ) );
+	i = _mm256_blendv_epi8( i, _mm256_sub_epi32( _mm256_set1_epi32( period - 1 ), i ), hi );
+    }
+    return( i );
+}
+
+AVX2_FN static inline void coord_avx2( __m256 s, int size, bool mirror, __m256i &i0, __m256i &i1, __m256 &w )
+{
+    if (mirror) s = _mm256_sub_ps( s, _mm256_mul_ps( _mm256_set1_ps( 2.0f ), _mm256_floor_ps( _mm256_mul_ps( s, _mm256_set1_ps( 0.5f ) ) ) ) );
+    else s = _mm256_sub_ps( s, _mm256_floor_ps( s ) );
+    __m256 u = _mm256_sub_ps( _mm256_mul_ps( s, _mm256_set1_ps( float(size) ) ), _mm256_set1_ps( 0.5f ) );
+    __m256 fu = _mm256_floor_ps( u );
+    w = _mm256_sub_ps( u, fu );
+    __m256i i = _mm256_cvttps_epi32( fu );
+    i0 = wrap_avx2( i, size, mirror );
+    i1 = wrap_avx2( _mm256_add_epi32( i, _mm256_set1_epi32( 1 ) ), size, mirror );
+}
+
+AVX2_FN static inline void unpack_avx2( __m256i c, __m256 &r, __m256 &g, __m256 &b )
+{
+    __m256i m = _mm256_set1_epi32( 0xff );
+    r = _mm256_cvtepi32_ps( _mm256_and_si256( c, m ) );
+    g = _mm256_cvtepi32_ps( _mm256_and_si256( _mm256_srli_epi32( c, 8 ), m ) );
+    b = _mm256_cvtepi32_ps( _mm256_and_si256( _mm256_srli_epi32( c, 16 ), m ) );
+}
+
+AVX2_FN static inline __m256 lerp_avx2( __m256 a, __m256 b, __m256 w )
+{
+    return( _mm256_add_ps( a, _mm256_mul_ps( _mm256_sub_ps( b, a ), w ) ) );
+}
+
+AVX2_FN static inline __m256i pack_avx2( __m256 r, __m256 g, __m256 b )
+{
+    __m256 lo = _mm256_setzero_ps();
+    __m256 hi = _mm256_set1_ps( 255.0f );
+    __m256i ir = _mm256_cvtps_epi32( _mm256_min_ps( _mm256_max_ps( r, lo ), hi ) );
+    __m256i ig = _mm256_cvtps_epi32( _mm256_min_ps( _mm256_max_ps( g, lo ), hi ) );
+    __m256i ib = _mm256_cvtps_epi32( _mm256_min_ps( _mm256_max_ps( b, lo ), hi ) );
+    __m256i c = _mm256_or_si256( ir, _mm256_slli_epi32( ig, 8 ) );
+    c = _mm256_or_si256( c, _mm256_slli_epi32( ib, 16 ) );
+    return( _mm256_or_si256( c, _mm256_set1_epi32( 0xff000000 ) ) );
+}
+
+AVX2_FN int cpu_renderer::span_avx2( int x, int y, int n, uint32_t *dst )
+{
+    const cpu_params &p = params;
+    const __m256 bail = _mm256_set1_ps( p.bailout );
+    const __m256i lane_bits = _mm256_set_epi32( 128, 64, 32, 16, 8, 4, 2, 1 );
+    int fetches = 0;
+    const __m256 lim = _mm256_set1_ps( ORBIT_LIMIT );
+    const __m256 nlim = _mm256_set1_ps( -ORBIT_LIMIT );
+    const __m256 half = _mm256_set1_ps( 0.5f );
+    const __m256 aspect = _mm256_set1_ps( vid_aspect );
+    const __m256 ty = _mm256_set1_ps( p.bottom + (y + 0.5f) * p.dy );
+    const __m256i pitch = _mm256_set1_epi32( tex_w );
+    const int *base = (const int *)tex;
+
+    for (int i = 0; i < n; i += 8)
+    {
+	__m256 lane = _mm256_add_ps( _mm256_set_ps( 7, 6, 5, 4, 3, 2, 1, 0 ), _mm256_set1_ps( float(x + i) + 0.5f ) );
+	__m256 tx = _mm256_add_ps( _mm256_set1_ps( p.left ), _mm256_mul_ps( lane, _mm256_set1_ps( p.dx ) ) );
+
+	__m256 px = ty, py = tx;
+	__m256 cx = p.julia ? _mm256_set1_ps( p.tpx * p.jx ) : _mm256_mul_ps( _mm256_set1_ps( p.tpx ), px );
+	__m256 cy = p.julia ? _mm256_set1_ps( p.tpy * p.jy ) : _mm256_mul_ps( _mm256_set1_ps( p.tpy ), py );
+	__m256 ar = _mm256_setzero_ps(), ag = _mm256_setzero_ps(), ab = _mm256_setzero_ps();
+	int live = (n - i >= 8) ? 0xff : (1 << (n - i)) - 1;
+
+	for (int k = 0; k < p.trips; ++k)
+	{
+	    __m256 nx = _mm256_add_ps( _mm256_sub_ps( _mm256_mul_ps( px, px ), _mm256_mul_ps( py, py ) ), cx );
+	    __m256 ny = _mm256_add_ps( _mm256_mul_ps( _mm256_add_ps( px, px ), py ), cy );
+	    px = _mm256_max_ps( _mm256_min_ps( nx, lim ), nlim );
+	    py = _mm256_max_ps( _mm256_min_ps( ny, lim ), nlim );
+	    if (p.poles) continue;
+
+	    if (p.bailout > 0)
+	    {
+		__m256 d = _mm256_add_ps( _mm256_mul_ps( px, px ), _mm256_mul_ps( py, py ) );
+		int esc = live & _mm256_movemask_ps( _mm256_cmp_ps( d, bail, _CMP_GT_OQ ) );
+		if (esc)
+		{
+		    __m256 m = _mm256_and_ps( _mm256_castsi256_ps( _mm256_cmpgt_epi32( _mm256_and_si256( _mm256_set1_epi32( esc ), lane_bits ), _mm256_setzero_si256() ) ),
+					      _mm256_set1_ps( float(p.trips - k) ) );
+		    ar = _mm256_add_ps( ar, _mm256_mul_ps( m, _mm256_set1_ps( mean[0] ) ) );
+		    ag = _mm256_add_ps( ag, _mm256_mul_ps( m, _mm256_set1_ps( mean[1] ) ) );
+		    ab = _mm256_add_ps( ab, _mm256_mul_ps( m, _mm256_set1_ps( mean[2] ) ) );
+		    fetches += __builtin_popcount( esc );
+		    live &= ~esc;
+		    if (!live) break;
+		}
+	    }
+	    fetches += __builtin_popcount( live );
+	    // dead lanes gather nothing and so add nothing
+	    __m256i mask = _mm256_cmpgt_epi32( _mm256_and_si256( _mm256_set1_epi32( live ), lane_bits ), _mm256_setzero_si256() );
+	    __m256i zero = _mm256_setzero_si256();
+
+	    __m256i i0, i1, j0, j1;
+	    __m256 wx, wy;
+	    coord_avx2( _mm256_add_ps( py, half ), tex_w, p.mirror, i0, i1, wx );
+	    coord_avx2( _mm256_add_ps( _mm256_mul_ps( px, aspect ), half ), tex_h, p.mirror, j0, j1, wy );
+	    j0 = _mm256_mullo_epi32( j0, pitch );
+	    j1 = _mm256_mullo_epi32( j1, pitch );
+
+	    __m256 r00, g00, b00, r10, g10, b10, r01, g01, b01, r11, g11, b11;
+	    unpack_avx2( _mm256_mask_i32gather_epi32( zero, base, _mm256_add_epi32( j0, i0 ), mask, 4 ), r00, g00, b00 );
+	    unpack_avx2( _mm256_mask_i32gather_epi32( zero, base, _mm256_add_epi32( j0, i1 ), mask, 4 ), r10, g10, b10 );
+	    unpack_avx2( _mm256_mask_i32gather_epi32( zero, base, _mm256_add_epi32( j1, i0 ), mask, 4 ), r01, g01, b01 );
+	    unpack_avx2( _mm256_mask_i32gather_epi32( zero, base, _mm256_add_epi32( j1, i1 ), mask, 4 ), r11, g11, b11 );
+	    ar = _mm256_add_ps( ar, lerp_avx2( lerp_avx2( r00, r10, wx ), lerp_avx2( r01, r11, wx ), wy ) );
+	    ag = _mm256_add_ps( ag, lerp_avx2( lerp_avx2( g00, g10, wx ), lerp_avx2( g01, g11, wx ), wy ) );
+	    ab = _mm256_add_ps( ab, lerp_avx2( lerp_avx2( b00, b10, wx ), lerp_avx2( b01, b11, wx ), wy ) );
+	}
+
+	__m256i c;
+	if (p.poles)
+	{
+	    __m256 len = _mm256_sqrt_ps( _mm256_add_ps( _mm256_mul_ps( px, px ), _mm256_mul_ps( py, py ) ) );
+	    __m256 nz = _mm256_cmp_ps( len, _mm256_setzero_ps(), _CMP_GT_OQ );
+	    __m256 rl = _mm256_and_ps( nz, _mm256_div_ps( _mm256_set1_ps( 1.0f ), len ) );
+	    __m256 blue = _mm256_min_ps( rl, len );
+	    __m256 s = _mm256_set1_ps( 127.5f );
+	    c = pack_avx2( _mm256_mul_ps( _mm256_add_ps( _mm256_mul_ps( px, rl ), _mm256_set1_ps( 1.0f ) ), s ),
+			   _mm256_mul_ps( _mm256_add_ps( _mm256_mul_ps( py, rl ), _mm256_set1_ps( 1.0f ) ), s ),
+			   _mm256_mul_ps( blue, _mm256_set1_ps( 255.0f ) ) );
+	}
+	else
+	{
+	    __m256 sc = _mm256_set1_ps( p.iter_scale );
+	    c = pack_avx2( _mm256_mul_ps( ar, sc ), _mm256_mul_ps( ag, sc ), _mm256_mul_ps( ab, sc ) );
+	}
+
+	if (i + 8 <= n) _mm256_storeu_si256( (__m256i *)(dst + i), c );
+	else
+	{
+	    uint32_t tmp[8];
+	    _mm256_storeu_si256( (__m256i *)tmp, c );
+	    for (int l = 0; i + l < n; ++l) dst[i + l] = tmp[l];
+	}
+    }
+    return( fetches );
+}
+
+//
+// deep kernel - scalar perturbation around the reference orbit in double
+//
+// The fallback for deep zoom: z = Z_m + d, where Z is the reference orbit
+// from the view center (computed at full precision by reference_orbit())
+// and d, the pixel's offset from it, is all that gets iterated:
+// d' = (2 Z_m + d) d + dc.  Once the orbit passes closer to 0 than d, or
+// the reference escapes, d is rebased onto the start of the reference.
+// Doubles hold d down to any zoom deep_real can place the center at.
+//
+
+int cpu_renderer::span_deep( int x, int y, int n, uint32_t *dst )
+{
+    const cpu_params &p = params;
+    const double *z0 = p.orbit;
+    const double lim = ORBIT_LIMIT;
+    int fetches = 0;
+    double ty = p.deep_bottom + (y + 0.5) * p.deep_dy;
+
+    for (int i = 0; i < n; ++i)
+    {
+	// p = gl_TexCoord[0].yx
+	double dx = ty, dy = p.deep_left + (x + i + 0.5) * p.deep_dx;
+	double dcx = p.julia ? 0 : p.tpx * dx;
+	double dcy = p.julia ? 0 : p.tpy * dy;
+	double zx = z0[0] + (z0[2] + dx), zy = z0[1] + (z0[3] + dy);
+	float rgb[3] = { 0, 0, 0 };
+	int m = 0;
+
+	for (int k = 0; k < p.trips; ++k)
+	{
+	    const double *zm = z0 + 4 * m;
+	    double ax = 2 * zm[0] + dx, ay = 2 * zm[1] + dy;
+	    double nx = ax * dx - ay * dy + dcx;
+	    double ny = ax * dy + ay * dx + dcy;
+	    // clamped like the sse2 orbit, so d * d never overflows
+	    dx = (nx > lim) ? lim : (nx < -lim) ? -lim : nx;
+	    dy = (ny > lim) ? lim : (ny < -lim) ? -lim : ny;
+	    zm = z0 + 4 * ++m;
+	    zx = zm[0] + (zm[2] + dx);
+	    zy = zm[1] + (zm[3] + dy);
+	    if (m == p.orbit_len - 1 || zx * zx + zy * zy < dx * dx + dy * dy)
+	    {
+		dx = (zx - z0[0]) - z0[2];
+		dy = (zy - z0[1]) - z0[3];
+		m = 0;
+	    }
+	    if (p.poles) continue;
+
+	    if (p.bailout > 0 && zx * zx + zy * zy > p.bailout)
+	    {
+		for (int c = 0; c < 3; ++c) rgb[c] += (p.trips - k) * mean[c];
+		++fetches;
+		break;
+	    }
+	    ++fetches;
+
+	    float s[3];
+	    sample( float(zy) + 0.5f, float(zx) * vid_aspect + 0.5f, s );
+	    for (int c = 0; c < 3; ++c) rgb[c] += s[c];
+	}
+
+	float out[3];
+	if (p.poles)
+	{
+	    // rg = 0.5 * (p / |p| + 1), b = min( |p|, 1 / |p| )
+	    float px = float(zx), py = float(zy);
+	    float len = sqrtf( px * px + py * py );
+	    float rl = (len > 0) ? 1.0f / len : 0;
+	    out[0] = (px * rl + 1.0f) * 127.5f;
+	    out[1] = (py * rl + 1.0f) * 127.5f;
+	    out[2] = ((rl < len) ? rl : len) * 255.0f;
+	}
+	else for (int c = 0; c < 3; ++c) out[c] = rgb[c] * p.iter_scale;
+
+	uint32_t c = 0xff000000u;
+	for (int k = 0; k < 3; ++k) c |= uint32_t(lrintf( (out[k] <= 0) ? 0 : (out[k] >= 255) ? 255 : out[k] )) << (8 * k);
+	dst[i] = c;
+    }
+    return( fetches );
+}
+
+//
+// has_extension - check the GL extension string for a whole extension name
+//
+
+static bool has_extension( const char *name )
+{
+    const char *ext = (const char *)glGetString( GL_EXTENSIONS );
+    size_t len = strlen( name );
+    for (const char *p = ext; p && (p = strstr( p, name )); p += len)
+	if ((p == ext || p[-1] == ' ') && (p[len] == ' ' || p[len] == 0)) return( true );
+    return( false );
+}
+
+//
+// pbo_ring - ring of pixel unpack buffers so that filling one doesn't wait for the GPU to read another
+//
+// Each buffer is fenced after the upload that reads it, and that fence is only
+// waited on when the ring wraps around to it again, so with the default depth
+// of 3 the copy of frame N+1 overlaps the GPU still uploading/shading frame N.
+// Buffers are mapped persistently with GL_ARB_buffer_storage, otherwise with
+// GL_MAP_UNSYNCHRONIZED_BIT (the fences make that safe).
+//
+
+class pbo_ring
+{
+private:
+    int			depth;
+    size_t		size;
+    bool		persistent;
+    GLuint		*bufs;
+    GLsync		*fences;
+    void		**ptrs;			// persistent mappings
+    int			cur;
+    double		stall;			// total ms spent waiting on fences
+
+public:
+    pbo_ring( size_t size, int n = 3 ) : depth(n), size(size), cur(0), stall(0)
+    {
+	if (depth < 1) depth = 1;
+	persistent = has_extension( "GL_ARB_buffer_storage" );
+	bufs = new GLuint[depth];
+	fences = new GLsync[depth];
+	ptrs = new void *[depth];
+	glGenBuffers( depth, bufs );
+	for (int i = 0; i < depth; ++i)
+	{
+	    fences[i] = 0;
+	    ptrs[i] = NULL;
+	    glBindBuffer( GL_PIXEL_UNPACK_BUFFER, bufs[i] );
+	    if (persistent)
+	    {
+		const GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage( GL_PIXEL_UNPACK_BUFFER, size, NULL, access );
+		ptrs[i] = glMapBufferRange( GL_PIXEL_UNPACK_BUFFER, 0, size, access );
+		if (!ptrs[i]) FAIL(( "Can't persistently map upload buffer" ));
+	    }
+	    else glBufferData( GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW );
+	}
+	glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+	CHECK_GLERROR();
+	if (verbose) DBUG(( "Upload ring of %d %s PBOs", depth, persistent ? "persistent" : "unsynchronized" ));
+    }
+
+    ~pbo_ring()
+    {
+	for (int i = 0; i < depth; ++i) if (fences[i]) glDeleteSync( fences[i] );
+	glDeleteBuffers( depth, bufs );
+	delete [] ptrs;
+	delete [] fences;
+	delete [] bufs;
+    }
+
+    // map - bind the next buffer as the unpack buffer and return a pointer to fill it through
+    void *map()
+    {
+	cur = (cur + 1) % depth;
+	glBindBuffer( GL_PIXEL_UNPACK_BUFFER, bufs[cur] );
+	if (fences[cur])
+	{
+	    double t0 = now_ms();
+	    glClientWaitSync( fences[cur], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED );
+	    stall += now_ms() - t0;
+	    glDeleteSync( fences[cur] );
+	    fences[cur] = 0;
+	}
+	if (persistent) return( ptrs[cur] );
+	void *p = glMapBufferRange( GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT );
+	CHECK_GLERROR();
+	return( p );
+    }
+
+    void unmap()
+    {
+	if (!persistent) glUnmapBuffer( GL_PIXEL_UNPACK_BUFFER );
+    }
+
+    // fence - mark the current buffer busy until the commands issued so far (its upload) complete
+    void fence()
+    {
+	fences[cur] = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+	glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+    }
+
+    double stall_ms() { return( stall ); }
+};
+
+//
+// frame_recorder - stream rendered frames to a file or pipe without stalling the renderer
+//
+// capture() starts an asynchronous glReadPixels of the framebuffer bound for
+// reading into the next of a ring of pixel pack buffers and fences it, and
+// collects the readbacks that have finished since: each is mapped, copied to
+// a free frame of a fixed pool and queued for a writer thread that converts
+// it to top-down RGB or Y4M and writes it, so the memory in flight is bounded
+// by the ring and the pool.  YUYV, NV12 and Y4M frames are instead read back
+// from convert_output()'s packed YUV, which the writer only has to write (or
+// split into planes), reading back half or three eighths of the bytes.  A
+// readback still running when the ring comes back round to it is waited for
+// (a readback stall), and a frame that finds the pool empty because the
+// writer can't keep up is dropped, or when lossless (headless runs and -Q
+// fifo) waited for instead (backpressure).
+// add() queues a frame that is already in memory, from the cpu renderer.
+// Given a vid_output instead of a file, the writer copies each frame into the
+// next buffer the device hands back, a row at a time for its line stride, and
+// drops it if none comes back within a second (unless lossless).
+//
+
+// list of recording formats
+#define LIST_RECORD_FORMATS(_) \
+_(rgb) \
+_(y4m) \
+_(yuyv) \
+_(nv12)
+
+enum record_format
+{
+    #define MK_RECORD_ENUM(name) RECORD_##name,
+    LIST_RECORD_FORMATS(MK_RECORD_ENUM)
+    N_RECORD_FORMATS
+};
+
+static record_format record_format_from_name( const char *name )
+{
+    #define MK_RECORD_MATCH(rname) if (!strcasecmp( name, #rname )) return( RECORD_##rname );
+    LIST_RECORD_FORMATS(MK_RECORD_MATCH)
+    return( N_RECORD_FORMATS );
+}
+
+static const char *record_format_name( int format )
+{
+    #define MK_RECORD_NAME(name) #name,
+    static const char *names[] = { LIST_RECORD_FORMATS(MK_RECORD_NAME) };
+    return( (format >= 0 && format < N_RECORD_FORMATS) ? names[format] : "?" );
+}
+
+static void write_frame( FILE *fp, const uint32_t *rgba, int w, int h, bool ppm );
+
+class frame_recorder
+{
+private:
+    FILE		*fp;
+    vid_output		*sink;			// or frames go to a video output device
+    record_format	format;
+    int			w, h;
+    bool		lossless;
+    bool		packed;			// readbacks are convert_output()'s YUYV or NV12, not RGBA
+    int			read_w, read_h;		// RGBA texels read back
+    int			depth;
+    GLuint		*bufs;			// pack buffers, and ring of the readbacks in them
+    GLsync		*fences;
+    int			next;			// buffer the next readback goes to
+    int			n_pending;		// readbacks not yet collected, the ones before next
+    int			n_pool;
+    uint32_t		**pool;			// frames for the writer, bottom-up RGBA or packed
+    int			*queued;		// ring of pool frames waiting to be written
+    int			q_head, q_count;
+    int			*free_list;
+    int			n_free;
+    unsigned char	*planes;		// y4m conversion, writer thread only
+    pthread_t		thread;
+    pthread_mutex_t	lock;
+    pthread_cond_t	queued_cv;
+    pthread_cond_t	free_cv;
+    bool		quitting;
+    unsigned long	n_frames;		// given to capture() or add()
+    unsigned long	n_written;
+    unsigned long	n_dropped;		// writer too slow
+    unsigned long	n_skipped;		// window not at the recording size
+    unsigned long	n_late;			// no device buffer came back in time
+    unsigned long	depth_sum;		// frames waiting to be written, summed at each get_free()
+    unsigned long	n_gets;
+    double		stall_ms;		// waiting on readbacks
+    double		backpressure_ms;	// waiting on the writer
+    double		device_ms;		// writer waiting on the device, writer thread only
+
+    // write_y4m - convert a bottom-up RGBA frame to BT.601 limited range 4:2:0 and write it
+    void write_y4m( const uint32_t *rgba )
+    {
+	int cw = (w + 1) / 2, ch = (h + 1) / 2;
+	unsigned char *y = planes, *u = y + w * h, *v = u + cw * ch;
+	for (int j = 0; j < h; ++j)
+	{
+	    const uint32_t *src = rgba + (h - 1 - j) * w;
+	    for (int i = 0; i < w; ++i)
+	    {
+		int r = src[i] & 0xff, g = (src[i] >> 8) & 0xff, b = (src[i] >> 16) & 0xff;
+		y[j * w + i] = ((66 * r + 129 * g + 25 * b + 128) >> 8) + 16;
+	    }
+	}
+	// chroma from the average of each 2x2 block, clamped at the edges
+	for (int j = 0; j < ch; ++j)
+	{
+	    const uint32_t *row0 = rgba + (h - 1 - 2 * j) * w;
+	    const uint32_t *row1 = (2 * j + 1 < h) ? row0 - w : row0;
+	    for (int i = 0; i < cw; ++i)
+	    {
+		int i1 = (2 * i + 1 < w) ? 2 * i + 1 : 2 * i;
+		uint32_t p[4] = { row0[2 * i], row0[i1], row1[2 * i], row1[i1] };
+		int r = 0, g = 0, b = 0;
+		for (int k = 0; k < 4; ++k)
+		{
+		    r += p[k] & 0xff;
+		    g += (p[k] >> 8) & 0xff;
+		    b += (p[k] >> 16) & 0xff;
+		}
+		u[j * cw + i] = ((-38 * r - 74 * g + 112 * b + 512) >> 10) + 128;
+		v[j * cw + i] = ((112 * r - 94 * g - 18 * b + 512) >> 10) + 128;
+	    }
+	}
+	if (fputs( "FRAME\n", fp ) < 0 || 1 != fwrite( planes, w * h + 2 * cw * ch, 1, fp ))
+	    FAIL(( "Error writing frame (%s)", strerror( errno ) ));
+    }
+
+    // write_packed - write a YUYV or NV12 frame as is, or NV12 as Y4M
+    void write_packed( const unsigned char *yuv )
+    {
+	if (RECORD_y4m == format)
+	{
+	    int n = w * h / 4;
+	    const unsigned char *uv = yuv + w * h;
+	    for (int i = 0; i < n; ++i)
+	    {
+		planes[i] = uv[2 * i];
+		planes[n + i] = uv[2 * i + 1];
+	    }
+	    if (fputs( "FRAME\n", fp ) < 0 || 1 != fwrite( yuv, w * h, 1, fp ) || 1 != fwrite( planes, 2 * n, 1, fp ))
+		FAIL(( "Error writing frame (%s)", strerror( errno ) ));
+	}
+	else if (1 != fwrite( yuv, read_w * read_h * 4, 1, fp )) FAIL(( "Error writing frame (%s)", strerror( errno ) ));
+    }
+
+    // write_device - copy a frame into the next free device buffer, top-down
+    void write_device( const uint32_t *frame )
+    {
+	int b;
+	double t0 = now_ms();
+	while ((b = sink->get()) < 0)
+	    if (!sink->wait( 1000 ) && !lossless) break;
+	device_ms += now_ms() - t0;
+	if (b < 0)
+	{
+	    ++n_late;
+	    return;
+	}
+
+	unsigned char *dst = (unsigned char *)sink->data( b );
+	int bpl = sink->bytesperline();
+	if (packed)
+	{
+	    // already top-down, NV12's interleaved chroma rows straight after the luma
+	    const unsigned char *src = (const unsigned char *)frame;
+	    for (int j = 0; j < read_h; ++j) memcpy( dst + j * bpl, src + j * read_w * 4, read_w * 4 );
+	}
+	else for (int j = 0; j < h; ++j)
+	{
+	    const uint32_t *src = frame + (h - 1 - j) * w;
+	    unsigned char *row = dst + j * bpl;
+	    for (int i = 0; i < w; ++i)
+	    {
+		row[3 * i + 0] = src[i];
+		row[3 * i + 1] = src[i] >> 8;
+		row[3 * i + 2] = src[i] >> 16;
+	    }
+	}
+	sink->put( b );
+    }
+
+    static void *run( void *arg )
+    {
+	frame_recorder *fr = (frame_recorder *)arg;
+	pthread_mutex_lock( &fr->lock );
+	for (;;)
+	{
+	    while (!fr->quitting && !fr->q_count) pthread_cond_wait( &fr->queued_cv, &fr->lock );
+	    if (!fr->q_count) break;
+	    int f = fr->queued[fr->q_head];
+	    pthread_mutex_unlock( &fr->lock );
+
+	    if (fr->sink) fr->write_device( fr->pool[f] );
+	    else if (fr->packed) fr->write_packed( (const unsigned char *)fr->pool[f] );
+	    else if (RECORD_y4m == fr->format) fr->write_y4m( fr->pool[f] );
+	    else write_frame( fr->fp, fr->pool[f], fr->w, fr->h, false );
+
+	    pthread_mutex_lock( &fr->lock );
+	    fr->q_head = (fr->q_head + 1) % fr->n_pool;
+	    --fr->q_count;
+	    fr->free_list[fr->n_free++] = f;
+	    ++fr->n_written;
+	    pthread_cond_signal( &fr->free_cv );
+	}
+	pthread_mutex_unlock( &fr->lock );
+	return( NULL );
+    }
+
+    // get_free - a pool frame to fill, -1 to drop the frame
+    int get_free()
+    {
+	pthread_mutex_lock( &lock );
+	depth_sum += q_count;
+	++n_gets;
+	if (!n_free && lossless)
+	{
+	    double t0 = now_ms();
+	    while (!n_free) pthread_cond_wait( &free_cv, &lock );
+	    backpressure_ms += now_ms() - t0;
+	}
+	int f = n_free ? free_list[--n_free] : -1;
+	if (f < 0) ++n_dropped;
+	pthread_mutex_unlock( &lock );
+	return( f );
+    }
+
+    void put( int f )
+    {
+	pthread_mutex_lock( &lock );
+	queued[(q_head + q_count++) % n_pool] = f;
+	pthread_cond_signal( &queued_cv );
+	pthread_mutex_unlock( &lock );
+    }
+
+    // collect - hand the oldest readback to the writer, waiting for it if it hasn't finished
+    void collect()
+    {
+	int b = (next - n_pending + depth) % depth;
+	double t0 = now_ms();
+	glClientWaitSync( fences[b], GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED );
+	stall_ms += now_ms() - t0;
+	glDeleteSync( fences[b] );
+	fences[b] = 0;
+	--n_pending;
+
+	int f = get_free();
+	if (f < 0) return;
+	glBindBuffer( GL_PIXEL_PACK_BUFFER, bufs[b] );
+	const void *p = glMapBufferRange( GL_PIXEL_PACK_BUFFER, 0, read_w * read_h * 4, GL_MAP_READ_BIT );
+	if (!p) FAIL(( "Can't map readback buffer" ));
+	memcpy( pool[f], p, read_w * read_h * 4 );
+	glUnmapBuffer( GL_PIXEL_PACK_BUFFER );
+	glBindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+	put( f );
+    }
+
+    // finished - whether the oldest readback is done, without waiting
+    bool finished()
+    {
+	int b = (next - n_pending + depth) % depth;
+	GLenum r = glClientWaitSync( fences[b], 0, 0 );
+	return( GL_ALREADY_SIGNALED == r || GL_CONDITION_SATISFIED == r );
+    }
+
+public:
+    // packed_yuv( format, w, h, read_w, read_h ) - whether format is read back as
+    // YUV, and the RGBA texels convert_output() packs it into
+    static bool packed_yuv( record_format format, int w, int h, int &read_w, int &read_h )
+    {
+	read_w = w;
+	read_h = h;
+	if (RECORD_yuyv == format && !(w % 2)) read_w = w / 2;
+	else if ((RECORD_nv12 == format || RECORD_y4m == format) && !(w % 4) && !(h % 2))
+	{
+	    read_w = w / 4;
+	    read_h = h + h / 2;
+	}
+	else return( false );
+	return( true );
+    }
+
+    frame_recorder( FILE *fp, vid_output *sink, record_format format, int w, int h, double fps, bool lossless, bool gl, int n = 3, int frames = 4 ) :
+	fp(fp), sink(sink), format(format), w(w), h(h), lossless(lossless), packed(false), read_w(w), read_h(h), depth(gl ? n : 0), bufs(NULL), fences(NULL), next(0), n_pending(0),
+	n_pool(frames), q_head(0), q_count(0), n_free(0), planes(NULL), quitting(false), n_frames(0), n_written(0), n_dropped(0),
+	n_skipped(0), n_late(0), depth_sum(0), n_gets(0), stall_ms(0), backpressure_ms(0), device_ms(0)
+    {
+	// the cpu renderer's frames are only ever RGBA
+	if (depth) packed = packed_yuv( format, w, h, read_w, read_h );
+	if ((RECORD_yuyv == format || RECORD_nv12 == format) && !packed)
+	    FAIL(( "Recording %s needs GL and a multiple of %s size", record_format_name( format ), (RECORD_yuyv == format) ? "2 wide" : "4 by 2" ));
+	if (depth)
+	{
+	    bufs = new GLuint[depth];
+	    fences = new GLsync[depth];
+	    glGenBuffers( depth, bufs );
+	    for (int i = 0; i < depth; ++i)
+	    {
+		fences[i] = 0;
+		glBindBuffer( GL_PIXEL_PACK_BUFFER, bufs[i] );
+		glBufferData( GL_PIXEL_PACK_BUFFER, w * h * 4, NULL, GL_STREAM_READ );
+	    }
+	    glBindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+	    CHECK_GLERROR();
+	}
+	pool = new uint32_t *[n_pool];
+	queued = new int[n_pool];
+	free_list = new int[n_pool];
+	for (int i = 0; i < n_pool; ++i)
+	{
+	    pool[i] = new uint32_t[w * h];
+	    free_list[n_free++] = i;
+	}
+
+	if (RECORD_y4m == format)
+	{
+	    planes = new unsigned char[w * h + 2 * ((w + 1) / 2) * ((h + 1) / 2)];
+	    // rates like 29.97 as thousandths
+	    if (fps <= 0) fps = 30;
+	    int num = int(fps * 1000 + 0.5), den = 1000;
+	    if (!(num % den)) num /= den, den = 1;
+	    fprintf( fp, "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 C420jpeg XCOLORRANGE=LIMITED\n", w, h, num, den );
+	}
+
+	pthread_mutex_init( &lock, NULL );
+	pthread_cond_init( &queued_cv, NULL );
+	pthread_cond_init( &free_cv, NULL );
+	if (pthread_create( &thread, NULL, run, this )) FAIL(( "Can't create writer thread" ));
+	if (verbose) DBUG(( "Recording %dx%d %s%s through %d PBOs and %d frames", w, h, record_format_name( format ),
+	    packed ? " converted on the GPU" : "", depth, n_pool ));
+    }
+
+    ~frame_recorder()
+    {
+	stop();
+	pthread_cond_destroy( &free_cv );
+	pthread_cond_destroy( &queued_cv );
+	pthread_mutex_destroy( &lock );
+
+	if (depth) glDeleteBuffers( depth, bufs );
+	delete [] fences;
+	delete [] bufs;
+	for (int i = 0; i < n_pool; ++i) delete [] pool[i];
+	delete [] pool;
+	delete [] queued;
+	delete [] free_list;
+	delete [] planes;
+    }
+
+    // capture - start reading back the w x h framebuffer bound for reading, or
+    // convert_output()'s packing of it
+    void capture( int fb_w, int fb_h )
+    {
+	++n_frames;
+	while (n_pending && finished()) collect();
+	if (fb_w != w || fb_h != h)
+	{
+	    ++n_skipped;
+	    return;
+	}
+	if (n_pending == depth) collect();
+
+	glBindBuffer( GL_PIXEL_PACK_BUFFER, bufs[next] );
+	glPixelStorei( GL_PACK_ALIGNMENT, 4 );
+	glReadPixels( 0, 0, read_w, read_h, GL_RGBA, GL_UNSIGNED_BYTE, NULL );
+	glBindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+	fences[next] = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+	next = (next + 1) % depth;
+	++n_pending;
+	CHECK_GLERROR();
+    }
+
+    // add - queue a bottom-up RGBA frame from memory
+    void add( const uint32_t *rgba )
+    {
+	++n_frames;
+	int f = get_free();
+	if (f < 0) return;
+	memcpy( pool[f], rgba, w * h * 4 );
+	put( f );
+    }
+
+    // stop - write out every frame still in flight and join the writer,
+    // dropping the readbacks instead once GL is gone
+    void stop( bool gl = true )
+    {
+	if (quitting) return;
+	if (!gl)
+	{
+	    n_dropped += n_pending;
+	    n_pending = 0;
+	    // and leave the buffers to go with the context
+	    depth = 0;
+	}
+	while (n_pending) collect();
+	pthread_mutex_lock( &lock );
+	quitting = true;
+	pthread_cond_signal( &queued_cv );
+	pthread_mutex_unlock( &lock );
+	pthread_join( thread, NULL );
+	if (fp) fflush( fp );
+    }
+
+    unsigned long dropped() { return( n_dropped + n_skipped + n_late ); }
+    int width() { return( w ); }
+    int height() { return( h ); }
+    // yuv - whether capture() wants convert_output()'s YUV, and NV12 rather than YUYV
+    bool yuv() { return( packed ); }
+    bool nv12() { return( RECORD_yuyv != format ); }
+
+    // report - after stop()
+    void report( FILE *fp )
+    {
+	fprintf( fp, "recorded %lu of %lu %dx%d frames as %s%s, %lu dropped for the writer, %lu for the window size, %.2f ms waiting on readbacks,"
+	    " %.2f ms on the writer, %.2f frames queued on average\n", n_written, n_frames, w, h, record_format_name( format ), packed ? " (GPU YUV)" : "",
+	    n_dropped, n_skipped, stall_ms, backpressure_ms, n_gets ? depth_sum / double(n_gets) : 0.0 );
+	if (sink) fprintf( fp, "  %lu dropped for the output device, %.2f ms waiting on its buffers\n", n_late, device_ms );
+    }
+};
+
+//
+// compare_double - qsort comparison for doubles
+//
+
+static int compare_double( const void *a, const void *b )
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return( (x < y) ? -1 : (x > y) ? 1 : 0 );
+}
+
+//
+// profiler - per-stage cpu and GPU frame timing
+//
+// Each stage is timed on the cpu with now_ms(), and GL stages are also
+// wrapped in GL_TIME_ELAPSED queries.  The queries for a frame are read back
+// PROFILE_LAG frames later, when they have long since completed, so profiling
+// never stalls the pipeline.  report() prints p50/p95/p99 per stage and dump()
+// writes every sample as CSV, or as a Chrome trace (chrome://tracing,
+// Perfetto) if the name ends in .json; GPU durations go on their own track,
+// aligned to where the cpu issued them.
+//
+
+// list of stage name and whether it is timed on the GPU
+#define LIST_STAGES(_) \
+_(capture,false) \
+_(upload,false) \
+_(texsubimage,true) \
+_(yuv2rgb,true) \
+_(mipmap,true) \
+_(fractal,true) \
+_(drawpixels,true) \
+_(rgb2yuv,true) \
+_(swap,false) \
+_(readback,true)
+
+enum profile_stage
+{
+    #define MK_STAGE_ENUM(name,gpu) STAGE_##name,
+    LIST_STAGES(MK_STAGE_ENUM)
+    N_STAGES
+};
+
+class profiler
+{
+private:
+    struct sample
+    {
+	int		frame;
+	int		stage;
+	double		start;			// ms since the profiler was created
+	double		cpu_ms;
+	double		gpu_ms;			// -1 if not timed on the GPU
+    };
+    struct pending
+    {
+	GLuint		query;
+	int		sample;			// index into samples, -1 if free
+    };
+
+    static const int	PROFILE_LAG = 4;	// frames before GPU results are collected
+    static const int	QUERIES_PER_FRAME = N_STAGES;
+
+    bool		use_gpu;
+    double		t0;
+    sample		*samples;
+    int			n_samples, max_samples;
+    int			open[N_STAGES];		// sample index of each running stage, or -1
+    int			frame_no;
+    pending		queries[PROFILE_LAG][QUERIES_PER_FRAME];
+    int			n_queries[PROFILE_LAG];
+    bool		gpu_busy;		// a GL_TIME_ELAPSED query is active
+
+    static const char *stage_name( int stage )
+    {
+	#define MK_STAGE_NAME(name,gpu) #name,
+	static const char *names[] = { LIST_STAGES(MK_STAGE_NAME) };
+	return( names[stage] );
+    }
+
+    static bool stage_gpu( int stage )
+    {
+	#define MK_STAGE_GPU(name,gpu) gpu,
+	static const bool gpu[] = { LIST_STAGES(MK_STAGE_GPU) };
+	return( gpu[stage] );
+    }
+
+    // collect - read back the queries issued for one slot of the ring
+    void collect( int slot )
+    {
+	for (int i = 0; i < n_queries[slot]; ++i)
+	{
+	    pending &q = queries[slot][i];
+	    GLuint64 ns = 0;
+	    glGetQueryObjectui64v( q.query, GL_QUERY_RESULT, &ns );
+	    // some drivers (llvmpipe) return garbage for their very first query,
+	    // so throw away anything longer than the time since it was issued
+	    if (q.sample >= 0 && ns * 1.0e-6 <= now_ms() - t0 - samples[q.sample].start)
+		samples[q.sample].gpu_ms = ns * 1.0e-6;
+	    q.sample = -1;
+	}
+	n_queries[slot] = 0;
+    }
+
+public:
+    profiler( bool gpu, int max = 1 << 20 ) : use_gpu(gpu), n_samples(0), max_samples(max), frame_no(-1), gpu_busy(false)
+    {
+	t0 = now_ms();
+	samples = new sample[max_samples];
+	for (int s = 0; s < N_STAGES; ++s) open[s] = -1;
+	for (int f = 0; f < PROFILE_LAG; ++f)
+	{
+	    n_queries[f] = 0;
+	    for (int i = 0; i < QUERIES_PER_FRAME; ++i)
+	    {
+		queries[f][i].query = 0;
+		queries[f][i].sample = -1;
+		if (use_gpu) glGenQueries( 1, &queries[f][i].query );
+	    }
+	}
+    }
+
+    ~profiler()
+    {
+	if (use_gpu)
+	    for (int f = 0; f < PROFILE_LAG; ++f)
+		for (int i = 0; i < QUERIES_PER_FRAME; ++i) glDeleteQueries( 1, &queries[f][i].query );
+	delete [] samples;
+    }
+
+    // frame - start the next frame, collecting GPU times from PROFILE_LAG frames ago
+    void frame()
+    {
+	++frame_no;
+	if (use_gpu) collect( frame_no % PROFILE_LAG );
+    }
+
+    void begin( int stage )
+    {
+	if (n_samples >= max_samples || frame_no < 0) return;
+	int i = n_samples++;
+	samples[i].frame = frame_no;
+	samples[i].stage = stage;
+	samples[i].gpu_ms = -1;
+	open[stage] = i;
+
+	// time elapsed queries can't nest, so only the outermost GL stage gets one
+	int slot = frame_no % PROFILE_LAG;
+	if (use_gpu && stage_gpu( stage ) && !gpu_busy && n_queries[slot] < QUERIES_PER_FRAME)
+	{
+	    pending &q = queries[slot][n_queries[slot]++];
+	    q.sample = i;
+	    glBeginQuery( GL_TIME_ELAPSED, q.query );
+	    gpu_busy = true;
+	}
+	samples[i].start = now_ms() - t0;
+    }
+
+    void end( int stage )
+    {
+	int i = open[stage];
+	if (i < 0) return;
+	samples[i].cpu_ms = now_ms() - t0 - samples[i].start;
+	open[stage] = -1;
+	int slot = frame_no % PROFILE_LAG;
+	if (gpu_busy && n_queries[slot] > 0 && queries[slot][n_queries[slot] - 1].sample == i)
+	{
+	    glEndQuery( GL_TIME_ELAPSED );
+	    gpu_busy = false;
+	}
+    }
+
+    // finish - wait for and collect every outstanding GPU time, needs the GL context
+    void finish()
+    {
+	if (!use_gpu) return;
+	for (int f = 0; f < PROFILE_LAG; ++f) collect( f );
+    }
+
+    void report( FILE *fp )
+    {
+	double *v = new double[n_samples + 1];
+	fprintf( fp, "%-12s %8s %8s %8s %8s   %8s %8s %8s\n", "stage", "count", "cpu p50", "p95", "p99", "gpu p50", "p95", "p99" );
+	for (int s = 0; s < N_STAGES; ++s)
+	{
+	    double pc[2][3];
+	    int count = 0;
+	    for (int g = 0; g < 2; ++g)
+	    {
+		int n = 0;
+		for (int i = 0; i < n_samples; ++i)
+		    if (samples[i].stage == s && (g ? samples[i].gpu_ms : samples[i].cpu_ms) >= 0)
+			v[n++] = g ? samples[i].gpu_ms : samples[i].cpu_ms;
+		if (!g) count = n;
+		qsort( v, n, sizeof(double), compare_double );
+		for (int p = 0; p < 3; ++p)
+		{
+		    static const double pct[3] = { 0.50, 0.95, 0.99 };
+		    pc[g][p] = n ? v[int(pct[p] * (n - 1) + 0.5)] : -1;
+		}
+	    }
+	    if (!count) continue;
+	    fprintf( fp, "%-12s %8d %8.3f %8.3f %8.3f", stage_name( s ), count, pc[0][0], pc[0][1], pc[0][2] );
+	    if (pc[1][0] >= 0) fprintf( fp, "   %8.3f %8.3f %8.3f\n", pc[1][0], pc[1][1], pc[1][2] );
+	    else fprintf( fp, "   %8s %8s %8s\n", "-", "-", "-" );
+	}
+	if (n_samples >= max_samples) fprintf( fp, "(sample buffer filled, later frames were not recorded)\n" );
+	delete [] v;
+    }
+
+    void dump( const char *name )
+    {
+	FILE *fp = fopen( name, "w" );
+	if (!fp) FAIL(( "Can't create %s", name ));
+	size_t len = strlen( name );
+	if (len > 5 && !strcmp( name + len - 5, ".json" ))
+	{
+	    fprintf( fp, "{\"traceEvents\":[\n" );
+	    fprintf( fp, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"cpu\"}},\n" );
+	    fprintf( fp, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"gpu\"}}" );
+	    for (int i = 0; i < n_samples; ++i)
+	    {
+		const sample &s = samples[i];
+		fprintf( fp, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%d}}",
+		    stage_name( s.stage ), s.start * 1e3, s.cpu_ms * 1e3, s.frame );
+		if (s.gpu_ms >= 0)
+		    fprintf( fp, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":2,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%d}}",
+			stage_name( s.stage ), s.start * 1e3, s.gpu_ms * 1e3, s.frame );
+	    }
+	    fprintf( fp, "\n]}\n" );
+	}
+	else
+	{
+	    fprintf( fp, "frame,stage,start_ms,cpu_ms,gpu_ms\n" );
+	    for (int i = 0; i < n_samples; ++i)
+	    {
+		const sample &s = samples[i];
+		fprintf( fp, "%d,%s,%.4f,%.4f,", s.frame, stage_name( s.stage ), s.start, s.cpu_ms );
+		if (s.gpu_ms >= 0) fprintf( fp, "%.4f\n", s.gpu_ms );
+		else fprintf( fp, "\n" );
+	    }
+	}
+	fclose( fp );
+    }
+};
+
+//
+// latency_log - how long video frames take from capture to the screen
+//
+// Each frame that gets rendered is followed from its capture timestamp (the
+// driver's, for V4L2 devices with monotonic timestamps) to when it was
+// dequeued, uploaded, drawn (the last GL command for it submitted) and
+// submitted for display, all on CLOCK_MONOTONIC.  The submit mark is when
+// glutSwapBuffers() returns, which only queues the swap: the GPU may still be
+// rendering the frame and the display has yet to scan it out, neither of
+// which is visible from here, so the total is a lower bound on glass-to-glass
+// latency.  Frames rendered again without a new video frame aren't counted.
+//
+
+// list of the points a frame's latency is measured at
+#define LIST_LATENCY(_) \
+_(dequeue) \
+_(upload) \
+_(draw) \
+_(submit)
+
+enum latency_mark
+{
+    #define MK_LATENCY_ENUM(name) LAT_##name,
+    LIST_LATENCY(MK_LATENCY_ENUM)
+    N_LATENCY_MARKS
+};
+
+class latency_log
+{
+private:
+    double		(*samples)[N_LATENCY_MARKS];	// ms after capture
+    int			n_samples, max_samples;
+    double		captured;		// of the frame being followed, -1 if none
+    double		current[N_LATENCY_MARKS];
+    unsigned long	n_untimed;		// frames without a capture timestamp
+
+public:
+    latency_log( int max = 1 << 18 ) : n_samples(0), max_samples(max), captured(-1), n_untimed(0)
+    {
+	samples = new double[max_samples][N_LATENCY_MARKS];
+    }
+
+    ~latency_log()
+    {
+	delete [] samples;
+    }
+
+    // frame - start following a new video frame
+    void frame( double capture_ms, double dequeue_ms )
+    {
+	captured = capture_ms;
+	if (captured < 0)
+	{
+	    ++n_untimed;
+	    return;
+	}
+	for (int m = 0; m < N_LATENCY_MARKS; ++m) current[m] = -1;
+	current[LAT_dequeue] = dequeue_ms - captured;
+    }
+
+    // mark - the frame reached this point, submitting it finishes it
+    void mark( int m )
+    {
+	if (captured < 0) return;
+	current[m] = now_ms() - captured;
+	if (LAT_submit != m) return;
+	if (n_samples < max_samples)
+	    for (int i = 0; i < N_LATENCY_MARKS; ++i) samples[n_samples][i] = current[i];
+	++n_samples;
+	captured = -1;
+    }
+
+    void report( FILE *fp, unsigned long captured_frames, unsigned long dropped )
+    {
+	static const char *names[] = {
+	    #define MK_LATENCY_NAME(name) #name,
+	    LIST_LATENCY(MK_LATENCY_NAME)
+	};
+	int n = (n_samples < max_samples) ? n_samples : max_samples;
+	double *v = new double[n + 1];
+	fprintf( fp, "%-12s %8s %8s %8s %8s %8s   (ms after capture)\n", "latency", "count", "p50", "p95", "p99", "max" );
+	for (int m = 0; m < N_LATENCY_MARKS; ++m)
+	{
+	    int count = 0;
+	    for (int i = 0; i < n; ++i) if (samples[i][m] >= 0) v[count++] = samples[i][m];
+	    if (!count) continue;
+	    qsort( v, count, sizeof(double), compare_double );
+	    fprintf( fp, "%-12s %8d %8.3f %8.3f %8.3f %8.3f\n", names[m], count,
+		v[int(0.50 * (count - 1) + 0.5)], v[int(0.95 * (count - 1) + 0.5)], v[int(0.99 * (count - 1) + 0.5)], v[count - 1] );
+	}
+	if (n_untimed) fprintf( fp, "(%lu frames had no capture timestamp)\n", n_untimed );
+	if (captured_frames)
+	    fprintf( fp, "%lu of %lu captured frames (%.1f%%) were replaced by a newer one before they were drawn\n",
+		dropped, captured_frames, 100.0 * dropped / captured_frames );
+	delete [] v;
+    }
+};
+
+//
+// frame_governor - trade resolution and iterations for frame rate
+//
+// The time between frames, less whatever was spent blocked on vsync in the
+// swap, is averaged, and when it runs over the budget for the target frame
+// rate the fractal is first rendered at a lower resolution (down to half
+// size, upscaled to the window) and then with fewer iterations.  Quality only
+// comes back once the average predicts that the step up still fits
+// comfortably, and nothing changes for a few frames after each step, so the
+// image doesn't flicker between two settings.
+//
+
+class frame_governor
+{
+private:
+    static const int	SETTLE_FRAMES = 8;	// frames ignored after each change
+
+    double		budget_ms;
+    bool		can_scale;
+    double		last_start;		// now_ms() at the start of the previous frame
+    double		idle_ms;		// time since then spent waiting, not rendering
+    double		avg_ms;			// < 0 until there is a sample
+    int			settle;
+    float		res_scale;		// render size relative to the window
+    float		iter_frac;		// fraction of the iteration count to use
+
+    static int iterations_for( int wanted, float frac )
+    {
+	int n = int(wanted * frac + 0.5f);
+	return( (n < 1) ? 1 : n );
+    }
+
+    // adjust - step quality down or up if the average frame calls for it
+    void adjust( int wanted )
+    {
+	// the cost goes with the pixel count and the shader trips (plus one
+	// for the fixed work), so predict what a step up would cost
+	int iters = iterations( wanted );
+	if (avg_ms > budget_ms * 1.05)
+	{
+	    if (can_scale && res_scale > 0.5f) res_scale = fmaxf( 0.5f, res_scale * 0.84f );
+	    else if (iters > 1) iter_frac = fminf( iter_frac * 0.84f, float(iters - 1) / wanted );
+	    else return;
+	}
+	else if (iter_frac < 1)
+	{
+	    float frac = fminf( 1.0f, fmaxf( iter_frac / 0.84f, float(iters + 1) / wanted ) );
+	    if (avg_ms * (iterations_for( wanted, frac ) + 1) / (iters + 1) > budget_ms * 0.9) return;
+	    iter_frac = frac;
+	}
+	else if (res_scale < 1)
+	{
+	    float scale = fminf( 1.0f, res_scale / 0.84f );
+	    if (avg_ms * (scale * scale) / (res_scale * res_scale) > budget_ms * 0.9) return;
+	    res_scale = scale;
+	}
+	else return;
+
+	if (verbose) DBUG(( "governor: %.2f ms, scale %.2f, %d/%d iterations", avg_ms, res_scale, iterations( wanted ), wanted ));
+	avg_ms = -1;
+	settle = SETTLE_FRAMES;
+    }
+
+public:
+    frame_governor( double target_fps, bool scale ) : can_scale(scale)
+    {
+	budget_ms = 1000.0 / target_fps;
+	reset();
+    }
+
+    void reset()
+    {
+	last_start = 0;
+	idle_ms = 0;
+	avg_ms = -1;
+	settle = 0;
+	res_scale = 1;
+	iter_frac = 1;
+    }
+
+    float scale() { return( res_scale ); }
+    int iterations( int wanted ) { return( iterations_for( wanted, iter_frac ) ); }
+
+    // frame - account for the last frame and settle this one's resolution and iterations
+    void frame( int wanted )
+    {
+	double now = now_ms();
+	if (last_start > 0)
+	{
+	    double ms = now - last_start - idle_ms;
+	    if (settle > 0) --settle;
+	    else avg_ms = (avg_ms < 0) ? ms : avg_ms + 0.125 * (ms - avg_ms);
+	}
+	last_start = now;
+	idle_ms = 0;
+	if (avg_ms >= 0 && !settle) adjust( wanted );
+    }
+
+    // idle - time spent in the frame that rendering couldn't use (vsync)
+    void idle( double ms ) { idle_ms += ms; }
+};
+
+//
+// program_cache - linked programs by source, with their uniform locations and
+// binaries saved to disk
+//
+// Uniform locations are looked up once when a program is first made, so
+// drawing never goes through glGetUniformLocation.  With
+// GL_ARB_get_program_binary the linked binary is written to the cache
+// directory under a hash of the driver strings and the source, and later runs
+// load it instead of compiling; a binary the driver rejects (after an update,
+// say) is just compiled again and replaced.
+//
+
+// list of every uniform used by any of the programs
+#define LIST_UNIFORMS(_) \
+_(yuv_tex) \
+_(size) \
+_(scale) \
+_(rgb_tex) \
+_(vid_aspect) \
+_(trans_scale) \
+_(iter_scale) \
+_(trips) \
+_(bailout) \
+_(c) \
+_(orbit) \
+_(orbit_len) \
+_(deep_scale) \
+_(unscale_at) \
+_(phases) \
+_(valid) \
+_(base_phase) \
+_(lod_bias) \
+_(cache_first) \
+_(orbit_cache) \
+_(cache_size) \
+_(frame) \
+_(flip)
+
+enum uniform_id
+{
+    #define MK_UNIFORM_ENUM(name) U_##name,
+    LIST_UNIFORMS(MK_UNIFORM_ENUM)
+    N_UNIFORMS
+};
+
+struct gl_program
+{
+    GLuint		id;
+    GLint		loc[N_UNIFORMS];	// -1 for uniforms the program doesn't use
+};
+
+GLuint make_frag_prog( const GLchar *pcszShader, bool retrievable = false );
+
+class program_cache
+{
+private:
+    struct entry
+    {
+	uint64_t	hash;
+	gl_program	prog;
+    };
+
+    entry		**entries;		// allocated one by one, so gl_program pointers stay put
+    int			n_entries, max_entries;
+    char		*dir;			// NULL to keep binaries in memory only
+    bool		binaries;
+    uint64_t		driver_hash;
+    int			n_compiled, n_loaded;
+
+    static const uint32_t BINARY_MAGIC = 0x42504256;	// "VBPB"
+
+    // fnv1a - 64 bit FNV-1a hash of a string, continuing from h
+    static uint64_t fnv1a( const char *s, uint64_t h = 14695981039346656037ull )
+    {
+	for (; s && *s; ++s) h = (h ^ (unsigned char)*s) * 1099511628211ull;
+	return( h );
+    }
+
+    void binary_name( char *name, size_t size, uint64_t hash )
+    {
+	snprintf( name, size, "%s/%016llx.bin", dir, (unsigned long long)hash );
+    }
+
+    // load - make a program from a saved binary, 0 if there isn't a usable one
+    GLuint load( uint64_t hash )
+    {
+	char name[PATH_MAX];
+	binary_name( name, sizeof(name), hash );
+	FILE *fp = fopen( name, "rb" );
+	if (!fp) return( 0 );
+
+	uint32_t header[3];
+	GLuint prog = 0;
+	if (1 == fread( header, sizeof(header), 1, fp ) && BINARY_MAGIC == header[0] && header[2] > 0 && header[2] < (64 << 20))
+	{
+	    char *data = new char[header[2]];
+	    if (1 == fread( data, header[2], 1, fp ))
+	    {
+		prog = glCreateProgram();
+		glProgramBinary( prog, header[1], data, header[2] );
+		GLint status = GL_FALSE;
+		glGetProgramiv( prog, GL_LINK_STATUS, &status );
+		if (!status)
+		{
+		    glDeleteProgram( prog );
+		    prog = 0;
+		}
+	    }
+	    delete [] data;
+	}
+	fclose( fp );
+	// clear any error from a stale binary
+	while (GL_NO_ERROR != glGetError()) ;
+	return( prog );
+    }
+
+    // save - write a program's binary, via a temporary file so readers never see half of one
+    void save( uint64_t hash, GLuint prog )
+    {
+	GLint len = 0;
+	glGetProgramiv( prog, GL_PROGRAM_BINARY_LENGTH, &len );
+	if (len <= 0) return;
+	char *data = new char[len];
+	GLenum format = 0;
+	glGetProgramBinary( prog, len, NULL, &format, data );
+
+	char name[PATH_MAX], tmp[PATH_MAX + 16];
+	binary_name( name, sizeof(name), hash );
+	snprintf( tmp, sizeof(tmp), "%s.%d", name, (int)getpid() );
+	FILE *fp = fopen( tmp, "wb" );
+	if (fp)
+	{
+	    uint32_t header[3] = { BINARY_MAGIC, format, uint32_t(len) };
+	    bool ok = (1 == fwrite( header, sizeof(header), 1, fp )) && (1 == fwrite( data, len, 1, fp ));
+	    ok = !fclose( fp ) && ok;
+	    if (!ok || rename( tmp, name )) unlink( tmp );
+	}
+	delete [] data;
+    }
+
+public:
+    program_cache() : entries(NULL), n_entries(0), max_entries(0), dir(NULL), binaries(false), driver_hash(0), n_compiled(0), n_loaded(0)
+    {
+    }
+
+    ~program_cache()
+    {
+	for (int i = 0; i < n_entries; ++i)
+	{
+	    glDeleteProgram( entries[i]->prog.id );
+	    delete entries[i];
+	}
+	delete [] entries;
+	delete [] dir;
+    }
+
+    // init - start caching binaries in cache_dir (NULL for memory only), needs a current context
+    void init( const char *cache_dir )
+    {
+	GLint formats = 0;
+	if (has_extension( "GL_ARB_get_program_binary" )) glGetIntegerv( GL_NUM_PROGRAM_BINARY_FORMATS, &formats );
+	binaries = cache_dir && formats > 0;
+	if (!binaries)
+	{
+	    if (verbose && cache_dir) DBUG(( "No program binary formats, not caching programs on disk" ));
+	    return;
+	}
+	// the same binary is only good for the same driver
+	driver_hash = fnv1a( (const char *)glGetString( GL_VENDOR ) );
+	driver_hash = fnv1a( (const char *)glGetString( GL_RENDERER ), driver_hash );
+	driver_hash = fnv1a( (const char *)glGetString( GL_VERSION ), driver_hash );
+
+	dir = new char[strlen( cache_dir ) + 1];
+	strcpy( dir, cache_dir );
+	// make the directory and its parent, the usual case being ~/.cache/vidbrot
+	char *slash = strrchr( dir, '/' );
+	if (slash && slash != dir)
+	{
+	    *slash = 0;
+	    mkdir( dir, 0755 );
+	    *slash = '/';
+	}
+	if (mkdir( dir, 0755 ) && EEXIST != errno) binaries = false;
+    }
+
+    // get - the program for a fragment shader source, made on first use
+    gl_program *get( const char *source )
+    {
+	uint64_t hash = fnv1a( source, driver_hash );
+	for (int i = 0; i < n_entries; ++i)
+	    if (entries[i]->hash == hash) return( &entries[i]->prog );
+
+	GLuint id = binaries ? load( hash ) : 0;
+	if (id) ++n_loaded;
+	else
+	{
+	    id = make_frag_prog( source, binaries );
+	    ++n_compiled;
+	    if (binaries) save( hash, id );
+	}
+
+	if (n_entries == max_entries)
+	{
+	    max_entries = max_entries ? 2 * max_entries : 16;
+	    entry **grown = new entry *[max_entries];
+	    for (int i = 0; i < n_entries; ++i) grown[i] = entries[i];
+	    delete [] entries;
+	    entries = grown;
+	}
+	entry &e = *(entries[n_entries++] = new entry);
+	e.hash = hash;
+	e.prog.id = id;
+	#define MK_UNIFORM_LOC(name) e.prog.loc[U_##name] = glGetUniformLocation( id, #name );
+	LIST_UNIFORMS(MK_UNIFORM_LOC)
+	return( &e.prog );
+    }
+
+    int compiled() { return( n_compiled ); }
+    int loaded() { return( n_loaded ); }
+};
+
+//
+// globals
+//
+
+static int scr_w = 640;
+static int scr_h = 480;
+static GLfloat vid_aspect, scr_aspect;
+
+static bool mirror = false;
+static bool showpoles = false;
+static bool animate_translation = false;
+static bool animate_translation_phase = false;
+static bool animate_iters = false;
+static bool dragging = false;
+static int drag_pt[2];
+static bool juliaing = false;
+static int julia_pt[2];
+
+// mandelbrot center, at full precision for deep zoom
+static deep_real cx( 0.0 );
+static deep_real cy( -0.5 );
+// julia seed point
 static GLfloat jx = 0;
 static GLfloat jy = 0;
 // zoom to edges of rect
-static GLfloat zoom = 1.5;
+static double zoom = 1.5;
 static float trans_scale = M_PI / 3.0;
 static float trans_phase = M_PI / 4.0;
 static int iter_max = 1.0;
 static int iter_dir = 1.0;
 static int iterations = iter_max;
 
-static GLfloat max_aniso = 1;
-static vid_capture *vidcap = NULL;
+static GLfloat max_aniso = 1;
+static GLfloat aniso_limit = 0;			// -a, 0 for whatever the driver allows
+static GLuint screen_fb = 0;			// where the fractal pass draws, an FBO when headless
+static GLuint screen_tex = 0;
+static frame_source *vidsrc = NULL;		// where video frames come from
+static vid_capture *vidcap = NULL;		// set when that is a capture device
+static capture_thread *capthread = NULL;	// NULL when headless
+static frame_converter *converter = NULL;	// between vidcap and vidsrc when it doesn't capture YUYV
+static double capture_fps = 30;			// -r for capture devices, 0 for the driver's choice
+static uint32_t capture_fourcc = 0;		// -F, 0 to negotiate
+static bool capture_capped = true;		// don't capture more pixels than the output shows (-S turns off)
+static int capture_buffers = 4;			// -B, buffers between the source and the renderer
+static queue_policy capture_policy = QUEUE_latest;	// -Q, how the renderer picks frames from them
+
+// a further video source, rendered into its own layer of rgb_tex
+struct video_input
+{
+    frame_source	*src;			// YUYV frames, through a converter if need be
+    frame_source	*raw;			// the file or device itself
+    capture_thread	*thread;
+    pbo_ring		*upload;
+    GLuint		yuv_tex;
+};
+static const int max_inputs = 8;
+static video_input inputs[max_inputs];		// layers 1.. of rgb_tex, vidsrc is layer 0
+static int n_inputs = 0;
+static GLenum rgb_target = GL_TEXTURE_2D;	// GL_TEXTURE_2D_ARRAY with inputs
+static bool layer_by_trip = false;		// orbits sample a different input each trip, rather than each tile
+static bool capturing = false;			// vidsrc has been started
+static bool headless = false;
+static profiler *prof = NULL;			// set when profiling with -P
+static latency_log *latency = NULL;		// likewise
+static const char *prof_file = NULL;
+static frame_recorder *recorder = NULL;		// set when streaming frames out with -o
+static FILE *record_fp = NULL;
+static vid_output *record_dev = NULL;			// -o naming a video output device
+static record_format record_fmt = N_RECORD_FORMATS;	// -O, or by the -o name
+static GLuint output_fb = 0;			// convert_output() packs YUV into output_tex
+static GLuint output_tex = 0;
+static int output_w = 0, output_h = 0;
+static GLuint output_copy_tex = 0;		// the window's back buffer, to convert it from
+static gl_program *output_progs[2] = { NULL, NULL };	// [nv12]
+
+static int mip_levels = 1000;			// -m, mip levels above the base to build, 1000 for all
+static bool mip_reuse = false;			// -M, keep the mip levels while the video is unchanged
+static int mip_max_level = 1000;		// GL_TEXTURE_MAX_LEVEL of rgb_tex
+static int mip_built = 0;			// levels of rgb_tex holding the current frame
+static uint64_t mip_frame_hash = 0;		// of the frame they were built from
+static bool bailout = false;			// stop fetching once an orbit escapes
+static float bailout_radius = 16;
+static bool bailout_grad = false;		// the shaders can fetch with explicit gradients past an escape
+static bool bailout_grad_array = false;		// and from texture arrays, for -d/-i layers
+static bool governing = false;			// let the governor lower resolution and iterations
+static frame_governor *governor = NULL;
+static double target_fps = 60;
+static GLuint lowres_fb = 0;			// reduced resolution fractal pass, when governing
+static GLuint lowres_tex = 0;
+static int lowres_w = 0, lowres_h = 0;
+static bool deep_zoom = true;			// 'z', perturb around a reference orbit where float runs out
+static bool deep_gl = false;			// the GL path can, it needs float textures for the orbit
+static const double deep_below = 1e-3;		// zoom it takes over at
+static const double deep_limit = 1e-45;		// and the deepest it goes, where the shader's scaled deltas run out
+static const int max_orbit = 4096;		// reference orbit entries, longer orbits rebase onto the start
+static double *deep_orbit = NULL;		// reference orbit, double hi and lo parts per entry for the cpu
+static float *deep_orbit_f = NULL;		// and float ones for orbit_tex
+static int deep_orbit_len = 0;
+static GLuint orbit_tex = 0;
+static bool orbit_stale = true;			// orbit_tex is behind deep_orbit_f
+static bool progressive = false;		// 'a', draw a quarter of the pixels each frame
+static GLuint phase_fb = 0;
+static GLuint phase_tex = 0;			// a layer per 2x2 block position, at half resolution
+static int phase_w = 0, phase_h = 0;
+static int phase_next = 0;			// into draw_progressive()'s phase order
+static unsigned phase_valid = 0;		// phases drawn since the view last changed
+static int phase_base = 0;			// the first of them
+static gl_program *composite_prog = NULL;	// interleaves the phases
+static bool orbit_caching = false;		// 'c', gather along orbits cached while the view holds still
+static int cache_targets = 0;			// cache layers one build pass writes, 0 without float textures
+static const double max_cache_mb = 256;		// views and trip counts needing more render live
+static GLuint cache_fb = 0;
+static GLuint cache_tex = 0;			// each pixel's sample points, two trips to an RGBA32F layer
+static int cache_w = 0, cache_h = 0, cache_layers = 0;
+static const int max_cache_targets = 8;		// a build pass writes at most
+static int max_cache_layers = 0;		// GL_MAX_ARRAY_TEXTURE_LAYERS
+
+#define PROFILE_BEGIN(stage) do { if (prof) prof->begin( STAGE_##stage ); } while (0)
+#define PROFILE_END(stage) do { if (prof) prof->end( STAGE_##stage ); } while (0)
+static cpu_renderer *cpu = NULL;		// set when rendering on the cpu instead of GLSL
+
+static GLuint yuv_tex = 0;			// YUYV source texture
+static GLuint rgb_tex = 0;			// converted RGB texture
+static GLuint feedback_tex = 0;			// feedback rendering buffer
+static GLuint fb = 0;				// FBO for YUV->RGB convert
+static GLuint feedback_fb = 0;			// FBO for feedback rendering path
+static program_cache *programs = NULL;
+static const char *program_dir = NULL;		// where program binaries are cached, NULL for nowhere
+static gl_program *yuv_prog = NULL;		// program for YUYV->RGB conversion
+static pbo_ring *upload = NULL;			// PBOs for video data copy to yuv_tex
+static int upload_depth = 3;
+static const int max_fixed_trips = 16;		// loop counts with a program of their own
+static gl_program *fractal_progs[2][2][2][2][2][2][3][max_fixed_trips + 1];	// [yuyv][julia][poles][bailout][layer by trip][deep][orbit_use][trips or 0], built on demand
+static GLint video_wrap = GL_REPEAT;		// wrap mode of the texture the fractal pass samples
+static bool yuv_direct = false;			// fractal pass samples yuv_tex, skipping the YUV->RGB pass
+static bool yuv_direct_set = false;		// what yuv_tex and rgb_tex are currently set up for
+static bool rgb_stale = false;			// rgb_tex is behind yuv_tex
+
+static bool zero_copy = false;			// capture straight into zc_bufs (V4L2 USERPTR)
+static int zc_count = 0;
+static GLuint *zc_bufs = NULL;			// persistently mapped PBOs, one per capture buffer
+static int zc_held = -1;			// capture buffer the GPU may still be reading
+static GLsync zc_fence = 0;			// signalled when the GPU is done with zc_held
+
+static void recapture( int w, int h );
+static void recapture_step( int dir );
+static void record_frame();
+
+//
+// CheckFramebufferStatus - see if we setup the framebuffer correctly or not
+//
+
+void CheckFramebufferStatus()
+{
+    switch (glCheckFramebufferStatusEXT( GL_FRAMEBUFFER_EXT ))
+    {
+    case GL_FRAMEBUFFER_COMPLETE_EXT:
+        break;
+    case GL_FRAMEBUFFER_UNSUPPORTED_EXT:
+        fprintf( stderr, "Unsupported framebuffer format\n" );
+        break;
+    case GL_FRAMEBUFFER_INCOMPLETE_ATTACHMENT_EXT:
+        fprintf( stderr, "Framebuffer incomplete, incomplete attachment\n" );
+    	break;
+    case GL_FRAMEBUFFER_INCOMPLETE_MISSING_ATTACHMENT_EXT:
+        fprintf( stderr, "Framebuffer incomplete, missing attachment\n" );
+        break;
+    case GL_FRAMEBUFFER_INCOMPLETE_DUPLICATE_ATTACHMENT_EXT:
+        fprintf( stderr, "Framebuffer incomplete, duplicate attachment\n" );
+        break;
+    case GL_FRAMEBUFFER_INCOMPLETE_DIMENSIONS_EXT:
+        fprintf( stderr, "Framebuffer incomplete, attached images must have same dimensions\n" );
+        break;
+    case GL_FRAMEBUFFER_INCOMPLETE_FORMATS_EXT:
+        fprintf( stderr, "Framebuffer incomplete, attached images must have same format\n" );
+        break;
+    case GL_FRAMEBUFFER_INCOMPLETE_DRAW_BUFFER_EXT:
+        fprintf( stderr, "Framebuffer incomplete, missing draw buffer\n" );
+        break;
+    case GL_FRAMEBUFFER_INCOMPLETE_READ_BUFFER_EXT:
+        fprintf( stderr, "Framebuffer incomplete, missing read buffer\n" );
+        break;
+    default:
+    	FAIL(( "Unknown frambuffer status 0x%04x!\n", glCheckFramebufferStatusEXT( GL_FRAMEBUFFER_EXT ) ));
+    }
+}
+
+//
+// elapsed_ms - return milliseconds of elapsed time since last call
+//
+
+float elapsed_ms()
+{
+    static double last = 0;
+    double now = now_ms();
+    float ms = (last > 0) ? float(now - last) : 0.0f;
+    last = now;
+    return( ms );
+}
+
+//
+// make_frag_prog - create a fragment-program only shader
+//
+
+GLuint make_frag_prog( const GLchar *pcszShader, bool retrievable )
+{
+    GLuint hShader = glCreateShader( GL_FRAGMENT_SHADER );
+    if (!hShader) FAIL(( "Can't create shader!" ));
+
+    const GLchar *ppcszShader[1] = { pcszShader };
+
+    glShaderSource( hShader, 1, ppcszShader, NULL );
+    glCompileShader( hShader );
+    GLint nStatus;
+    glGetShaderiv( hShader, GL_COMPILE_STATUS, &nStatus );
+    if (!nStatus)
+    {
+    	char szBuff[10240];
+	glGetShaderInfoLog( hShader, sizeof(szBuff), NULL, szBuff );
+	FAIL(( "Shader failed to compile:\n%s", szBuff ));
+    }
+    //printf( "Shader compiled okay!\n" );
+
+    GLuint hProgram = glCreateProgram();
+    if (!hProgram) FAIL(( "Can\'t create program!" ));
+
+    glAttachShader( hProgram, hShader );
+    // ask to be able to save the binary for next time
+    if (retrievable) glProgramParameteri( hProgram, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE );
+
+    glLinkProgram( hProgram );
+    glGetProgramiv( hProgram, GL_LINK_STATUS, &nStatus );
+    if (!nStatus)
+    {
+    	char szBuff[10240];
+	glGetProgramInfoLog( hProgram, sizeof(szBuff), NULL, szBuff );
+	FAIL(( "Program failed to link:\n%s", szBuff ));
+    }
+    //printf( "Program linked okay!\n" );
+    glDeleteShader( hShader );
+
+    return( hProgram );
+}
+
+//
+// setviewport - setup viewport and projection
+//
+
+void setviewport( int w, int h )
+{
+    glViewport( 0, 0, w, h );
+    glMatrixMode( GL_PROJECTION );
+    glLoadIdentity();
+    glOrtho( -1, 1, -1, 1, -1, 1 );
+}
+
+//
+// reshape - handle GLUT window resizing
+//
+
+void reshape( int w, int h )
+{
+    scr_w = w;
+    scr_h = h;
+    scr_aspect = h / GLfloat(w);
+    setviewport( w, h );
+}
+
+//
+// animate - step any animated parameters on by one frame
+//
+
+static void animate()
+{
+    if (animate_translation)
+    {
+	trans_scale += M_PI / 500.0f;
+	if (trans_scale >= 2 * M_PI) trans_scale -= 2 * M_PI;
+    }
+    if (animate_translation_phase)
+    {
+	trans_phase += M_PI / 500.0f;
+	if (trans_phase >= 2 * M_PI) trans_phase -= 2 * M_PI;
+    }
+    if (animate_iters)
+    {
+	iterations += iter_dir;
+	if (iterations >= iter_max)
+	{
+	    iterations = iter_max;
+	    iter_dir = -iter_dir;
+	}
+	else if (iterations <= 1)
+	{
+	    iterations = 1;
+	    iter_dir = -iter_dir;
+	}
+    }
+}
+
+//
+// trans_uniform - compute the trans_scale uniform from the translation scale and phase
+//
+
+static void trans_uniform( float &tpx, float &tpy )
+{
+    float trans = 2.0f * cosf( trans_scale );
+    trans = trans * trans * trans;
+    // default to 1,1 (traditional mandlebrot)
+    tpx = trans * cosf( trans_phase ) * M_SQRT2;
+    tpy = trans * sinf( trans_phase ) * M_SQRT2;
+}
+
+//
+// shader_trips - number of times the fractal shaders' loop runs for a given iter_scale
+//
+
+static int shader_trips( float iter_scale )
+{
+    // the shaders step s by iter_scale until it reaches 1.0, and rounding can add
+    // a trip (100 * 0.01f < 1.0), so count them the same way the GPU does
+    int trips = 0;
+    for (volatile float s = 0; s < 1.0f; s += iter_scale) ++trips;
+    return( trips );
+}
+
+//
+// deeping / clamp_zoom - whether this frame perturbs around a reference orbit, and how far zoom can go
+//
+
+static bool deeping()
+{
+    return( deep_zoom && (cpu || deep_gl) && zoom < deep_below );
+}
+
+static void clamp_zoom()
+{
+    double limit = (deep_zoom && (cpu || deep_gl)) ? deep_limit : 1e-9;
+    if (zoom < limit) zoom = limit;
+    if (zoom > 1e+3) zoom = 1e+3;
+}
+
+//
+// reference_orbit - iterate the view center at full precision for deep zoom
+//
+// Fills deep_orbit with Z_0 (the center, swapped into p like the shaders'
+// gl_TexCoord[0].yx) through Z_trips, each split into a hi and a lo part so
+// the renderers can rebase onto Z_0 without losing the bits the zoom lives
+// in.  It stops early once the orbit escapes, past which it couldn't be
+// stored anyway.  Nothing changes while the view and constants hold still.
+//
+
+static void reference_orbit( int trips )
+{
+    struct orbit_key
+    {
+	deep_real	cx, cy;
+	float		tpx, tpy, jx, jy;
+	bool		julia;
+	int		trips;
+    };
+    static orbit_key last;
+    // value-initialised, which zeroes the padding memcmp() sees too
+    orbit_key key = orbit_key();
+    key.cx = cx;
+    key.cy = cy;
+    trans_uniform( key.tpx, key.tpy );
+    key.jx = juliaing ? jx : 0;
+    key.jy = juliaing ? jy : 0;
+    key.julia = juliaing;
+    key.trips = trips;
+    if (deep_orbit && !memcmp( &key, &last, sizeof(key) )) return;
+    last = key;
+
+    if (!deep_orbit)
+    {
+	deep_orbit = new double[4 * max_orbit];
+	deep_orbit_f = new float[4 * max_orbit];
+    }
+
+    deep_real zx = cy, zy = cx;
+    deep_real tx( key.tpx ), ty( key.tpy );
+    deep_real ccx = juliaing ? tx * deep_real( jx ) : tx * zx;
+    deep_real ccy = juliaing ? ty * deep_real( jy ) : ty * zy;
+    int n = 0;
+    for (;;)
+    {
+	double *z = deep_orbit + 4 * n;
+	float *f = deep_orbit_f + 4 * n;
+	z[0] = zx;
+	z[1] = zy;
+	z[2] = zx - deep_real( z[0] );
+	z[3] = zy - deep_real( z[1] );
+	f[0] = float(z[0]);
+	f[1] = float(z[1]);
+	f[2] = float(double(zx - deep_real( double(f[0]) )));
+	f[3] = float(double(zy - deep_real( double(f[1]) )));
+	// always leave a step to rebase from
+	if (++n > trips || n == max_orbit || (n > 1 && z[0] * z[0] + z[1] * z[1] > 1e6)) break;
+	deep_real nx = zx * zx - zy * zy + ccx;
+	zy = (zx + zx) * zy + ccy;
+	zx = nx;
+    }
+    deep_orbit_len = n;
+    orbit_stale = true;
+}
+
+//
+// render_iterations / render_size - what to render this frame, after the governor
+//
+
+static int render_iterations()
+{
+    return( governing ? governor->iterations( iterations ) : iterations );
+}
+
+static void render_size( int &w, int &h )
+{
+    float scale = governing ? governor->scale() : 1.0f;
+    w = (scale < 1) ? int(scr_w * scale + 0.5f) : scr_w;
+    h = (scale < 1) ? int(scr_h * scale + 0.5f) : scr_h;
+    if (w < 1) w = 1;
+    if (h < 1) h = 1;
+}
+
+//
+// next_frame - newest video frame to render, or -1 to keep the last one
+//
+
+static int next_frame()
+{
+    PROFILE_BEGIN(capture);
+    // headless renders consume every frame in order, waiting for it if need be
+    int frameid = capthread ? capthread->get() : vidsrc->wait() ? vidsrc->get() : -1;
+    PROFILE_END(capture);
+    if (latency && frameid >= 0)
+    {
+	if (capthread) latency->frame( capthread->timestamp( frameid ), capthread->dequeue_time( frameid ) );
+	else latency->frame( vidsrc->timestamp( frameid ), now_ms() );
+    }
+    return( frameid );
+}
+
+static void *frame_data( int frameid )
+{
+    return( capthread ? capthread->data( frameid ) : vidsrc->data( frameid ) );
+}
+
+static void release_frame( int frameid )
+{
+    if (capthread) capthread->release( frameid );
+    else vidsrc->release( frameid );
+}
+
+//
+// display_cpu - fetch the video frame and render it with the cpu_renderer
+//
+
+static void display_cpu()
+{
+    if (!showpoles)
+    {
+	// without a new frame the previous one is still in the cpu texture
+	int frameid = next_frame();
+	if (frameid >= 0)
+	{
+	    PROFILE_BEGIN(upload);
+	    cpu->load_yuyv( frame_data( frameid ), vidsrc->width(), vidsrc->height(), vidsrc->bytesperline() );
+	    release_frame( frameid );
+	    PROFILE_END(upload);
+	    if (latency) latency->mark( LAT_upload );
+	}
+    }
+
+    animate();
+
+    cpu_params p;
+    clear( p );
+    render_size( p.width, p.height );
+    GLfloat fzoom = GLfloat(zoom);
+    p.left = GLfloat(cx) - fzoom;
+    p.dx = 2 * fzoom / p.width;
+    p.bottom = GLfloat(cy) + fzoom * scr_aspect;
+    p.dy = -2 * fzoom * scr_aspect / p.height;
+    trans_uniform( p.tpx, p.tpy );
+    p.jx = jx;
+    p.jy = jy;
+    p.julia = juliaing;
+    p.poles = showpoles;
+    p.mirror = mirror;
+    p.iter_scale = 1.0f / render_iterations();
+    p.trips = shader_trips( p.iter_scale );
+    p.bailout = bailout ? bailout_radius * bailout_radius : 0;
+    p.deep = deeping();
+    if (p.deep)
+    {
+	reference_orbit( p.trips );
+	p.orbit = deep_orbit;
+	p.orbit_len = deep_orbit_len;
+	p.deep_left = -zoom;
+	p.deep_dx = 2 * zoom / p.width;
+	p.deep_bottom = zoom * scr_aspect;
+	p.deep_dy = -2 * zoom * scr_aspect / p.height;
+    }
+    PROFILE_BEGIN(fractal);
+    cpu->render( p );
+    PROFILE_END(fractal);
+    if (headless) return;
+
+    glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+    glUseProgram( 0 );
+    glDisable( GL_TEXTURE_2D );
+    glWindowPos2i( 0, 0 );
+    glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+    glPixelZoom( scr_w / GLfloat(p.width), scr_h / GLfloat(p.height) );
+    PROFILE_BEGIN(drawpixels);
+    glDrawPixels( p.width, p.height, GL_RGBA, GL_UNSIGNED_BYTE, cpu->pixels() );
+    CHECK_GLERROR();
+    PROFILE_END(drawpixels);
+    glPixelZoom( 1, 1 );
+}
+
+// a subset of the view's pixels for draw_fractal() to draw
+struct view_part
+{
+    GLfloat		scale[2], offset[2];	// from the viewport's clip coordinates to the view's, x then y
+    GLfloat		spread;			// view pixels per pixel drawn
+};
+
+// what a fractal pass does with the orbits
+enum orbit_use
+{
+    ORBITS_LIVE,	// iterates them and samples the video along them
+    ORBITS_BUILD,	// iterates them into cache_tex
+    ORBITS_CACHED	// samples the video along the ones in cache_tex
+};
+
+static void draw_fractal( int w, int h, const view_part *part = NULL );
+static void draw_progressive( int w, int h, GLuint target );
+
+//
+// frame_hash - cheap 64 bit hash of a video frame, to tell whether it changed
+//
+
+static uint64_t frame_hash( const void *data, size_t len )
+{
+    const uint64_t *p = (const uint64_t *)data;
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i = 0; i < len / 8; ++i) h = (h ^ p[i]) * 1099511628211ull;
+    for (size_t i = len & ~size_t(7); i < len; ++i) h = (h ^ ((const unsigned char *)data)[i]) * 1099511628211ull;
+    return( h );
+}
+
+//
+// set_yuv_path - set yuv_tex up to be sampled by the fractal pass, or just by yuv_prog
+//
+// The direct path saves the YUV->RGB render pass and the FBO, but converts
+// every fetch of every trip instead of every video pixel once, and yuv_tex's
+// mip levels average the packed macropixels (which is fine, the conversion is
+// linear up to the clamp) so it blurs a little more.  Which one wins depends
+// on the iteration count and the video vs window size; -b measures both.
+//
+
+static void set_yuv_path()
+{
+    // there's only one yuv_tex to sample, inputs have to go through rgb_tex
+    if (n_inputs) yuv_direct = false;
+    if (yuv_direct == yuv_direct_set) return;
+
+    glBindTexture( GL_TEXTURE_2D, yuv_tex );
+    if (yuv_direct)
+    {
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, use_mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR );
+	if (use_aniso && max_aniso > 1) glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, max_aniso );
+    }
+    else
+    {
+	// yuv_prog samples it exactly at level 0, clamped at the edges
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+	if (use_aniso && max_aniso > 1) glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, 1 );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0 );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+	// rgb_tex missed whatever came in meanwhile
+	rgb_stale = true;
+    }
+    CHECK_GLERROR();
+
+    // make draw_fractal and build_mipmaps set up whichever texture is sampled now
+    video_wrap = -1;
+    mip_max_level = -1;
+    mip_built = 0;
+    yuv_direct_set = yuv_direct;
+}
+
+//
+// build_mipmaps - bring the mip levels of the texture the fractal pass samples up to date
+//
+// The fractal pass minifies the video heavily at high iteration counts, so by
+// default the whole chain is rebuilt with glGenerateMipmap after each new
+// frame.  -m caps the pyramid at fewer levels, which is cheaper to build and
+// sharper (and more aliased) to look at; bailout always gets the full chain
+// because it reads the video's mean colour from the 1x1 level.  Levels past
+// the cap that are still valid are kept, so toggling bailout while the video
+// is paused only builds them once.
+//
+
+static GLuint video_tex()
+{
+    return( yuv_direct ? yuv_tex : rgb_tex );
+}
+
+static GLenum video_target()
+{
+    return( yuv_direct ? GL_TEXTURE_2D : rgb_target );
+}
+
+static void build_mipmaps()
+{
+    int levels = bailout ? 1000 : mip_levels;
+    if (levels <= mip_built && levels == mip_max_level) return;
+
+    glBindTexture( video_target(), video_tex() );
+    if (levels != mip_max_level)
+    {
+	glTexParameteri( video_target(), GL_TEXTURE_MAX_LEVEL, levels );
+	mip_max_level = levels;
+    }
+    if (levels > mip_built)
+    {
+	PROFILE_BEGIN(mipmap);
+	glGenerateMipmap( video_target() );
+	CHECK_GLERROR();
+	PROFILE_END(mipmap);
+	mip_built = levels;
+    }
+}
+
+//
+// convert_yuv - convert a w x h YUYV texture into layer of rgb_tex (via FBO)
+//
+// Inputs of another size than vidsrc are scaled to it on the way.
+//
+
+static void convert_yuv( GLuint tex, int w, int h, int layer )
+{
+    glBindFramebuffer( GL_FRAMEBUFFER, fb );
+    glBindTexture( rgb_target, rgb_tex );
+    if (GL_TEXTURE_2D_ARRAY == rgb_target) glFramebufferTextureLayer( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, rgb_tex, 0, layer );
+    else glFramebufferTexture2D( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, rgb_tex, 0 );
+
+    CheckFramebufferStatus();
+
+    glViewport( 0, 0, vidsrc->width(), vidsrc->height() );
+    glMatrixMode( GL_PROJECTION );
+    glLoadIdentity();
+    glOrtho( 0, 1, 0, 1, 0, 1 );
+
+    glMatrixMode( GL_MODELVIEW );
+    glLoadIdentity();
+
+    glUseProgram( yuv_prog->id );
+    glUniform2f( yuv_prog->loc[U_size], GLfloat(w), GLfloat(h) );
+    glUniform2f( yuv_prog->loc[U_scale], 1.0 / GLfloat(w), 1.0 / GLfloat(h) );
+
+    glBindTexture( GL_TEXTURE_2D, tex );
+    glTexEnvi( GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE );
+    glEnable( GL_TEXTURE_2D );
+
+    glBegin( GL_TRIANGLES );
+	glTexCoord2f( -1,  1 ); glVertex2f( -1,  1 );
+	glTexCoord2f(  1,  1 ); glVertex2f(  1,  1 );
+	glTexCoord2f(  1, -1 ); glVertex2f(  1, -1 );
+    glEnd();
+    CHECK_GLERROR();
+}
+
+//
+// convert_output - pack a w x h RGB texture into YUYV or NV12 in output_tex, and leave output_fb bound
+//
+// This is yuv_prog run backwards, its BT.601 matrix inverted, with each
+// YUYV macropixel's chroma from the average of its two pixels, which is where
+// yuv_prog takes it to be sited, and NV12's from the average of a 2x2 block.
+// Both go in RGBA8 texels in memory order, so a plain glReadPixels of the
+// whole texture gets the packed frame: YUYV at w / 2 x h, and NV12 at w / 4 x
+// (h + h / 2), four Y or two UV pairs to a texel.  Rows come out top down,
+// flipping the texture's bottom up rows unless flip is false.  The texture
+// has to be NEAREST, CLAMP_TO_EDGE and without anisotropy, as screen_tex and
+// output_copy_tex are, so each fetch is exactly one texel.
+//
+
+static const char output_src[] =
+	"uniform sampler2D frame;\n"
+	"uniform vec2 size;\n"
+	"uniform float flip;\n"
+	"\n"
+	"vec3 rgb_yuv( float x, float row )\n"
+	"{\n"
+	"   // texel (x, row) of the base level, exactly with the texture's nearest, clamped sampling\n"
+	"   vec3 c = texture2D( frame, vec2( x + 0.5, mix( row, size.y - 1.0 - row, flip ) + 0.5 ) / size, -16.0 ).rgb;\n"
+	"   return( vec3( dot( c, vec3( 0.256816, 0.504155, 0.097914 ) ) + 0.0625,\n"
+	"                 dot( c, vec3( -0.148246, -0.291020, 0.439266 ) ) + 0.5,\n"
+	"                 dot( c, vec3( 0.439271, -0.367833, -0.071438 ) ) + 0.5 ) );\n"
+	"}\n"
+	"\n"
+	"void main( void )\n"
+	"{\n"
+	"   vec2 t = floor( gl_FragCoord.xy );\n"
+	"#ifdef NV12\n"
+	"   float x = 4.0 * t.x;\n"
+	"   if (t.y < size.y)\n"
+	"   {\n"
+	"       gl_FragColor = vec4( rgb_yuv( x, t.y ).x, rgb_yuv( x + 1.0, t.y ).x, rgb_yuv( x + 2.0, t.y ).x, rgb_yuv( x + 3.0, t.y ).x );\n"
+	"       return;\n"
+	"   }\n"
+	"   float row = 2.0 * (t.y - size.y);\n"
+	"   vec2 uv0 = rgb_yuv( x, row ).yz + rgb_yuv( x + 1.0, row ).yz + rgb_yuv( x, row + 1.0 ).yz + rgb_yuv( x + 1.0, row + 1.0 ).yz;\n"
+	"   vec2 uv1 = rgb_yuv( x + 2.0, row ).yz + rgb_yuv( x + 3.0, row ).yz + rgb_yuv( x + 2.0, row + 1.0 ).yz + rgb_yuv( x + 3.0, row + 1.0 ).yz;\n"
+	"   gl_FragColor = 0.25 * vec4( uv0, uv1 );\n"
+	"#else\n"
+	"   vec3 a = rgb_yuv( 2.0 * t.x, t.y );\n"
+	"   vec3 b = rgb_yuv( 2.0 * t.x + 1.0, t.y );\n"
+	"   gl_FragColor = vec4( a.x, 0.5 * (a.y + b.y), b.x, 0.5 * (a.z + b.z) );\n"
+	"#endif\n"
+	"}\n";
+
+static void convert_output( GLuint tex, int w, int h, bool nv12, bool flip = true )
+{
+    int tw = nv12 ? w / 4 : w / 2, th = nv12 ? h + h / 2 : h;
+    if (!output_fb) glGenFramebuffers( 1, &output_fb );
+    glBindFramebuffer( GL_FRAMEBUFFER, output_fb );
+    if (tw != output_w || th != output_h)
+    {
+	if (!output_tex) glGenTextures( 1, &output_tex );
+	glBindTexture( GL_TEXTURE_2D, output_tex );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+	glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA8, tw, th, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL );
+	glFramebufferTexture2D( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, output_tex, 0 );
+	CheckFramebufferStatus();
+	output_w = tw;
+	output_h = th;
+    }
+    gl_program *&prog = output_progs[nv12];
+    if (!prog)
+    {
+	const char *src = nv12 ? "#define NV12\n" : "";
+	char *full = new char[strlen( src ) + sizeof(output_src)];
+	strcpy( full, src );
+	strcat( full, output_src );
+	prog = programs->get( full );
+	delete [] full;
+	glUseProgram( prog->id );
+	glUniform1i( prog->loc[U_frame], 0 );
+    }
+
+    PROFILE_BEGIN(rgb2yuv);
+    setviewport( tw, th );
+    glMatrixMode( GL_MODELVIEW );
+    glLoadIdentity();
+    glUseProgram( prog->id );
+    glUniform2f( prog->loc[U_size], GLfloat(w), GLfloat(h) );
+    glUniform1f( prog->loc[U_flip], flip ? 1.0f : 0.0f );
+    glBindTexture( GL_TEXTURE_2D, tex );
+    glBegin( GL_TRIANGLES );
+	glVertex2f( -3,  1 );
+	glVertex2f(  1,  1 );
+	glVertex2f(  1, -3 );
+    glEnd();
+    CHECK_GLERROR();
+    PROFILE_END(rgb2yuv);
+}
+
+//
+// display_gl - fetch the video frame and render it with the GLSL programs
+//
+
+static void display_gl()
+{
+    // only fetch the video frame if we're using it, and without a new one
+    // the previous frame is still sitting in rgb_tex
+    int frameid = showpoles ? -1 : next_frame();
+
+    // with -M, a frame that matches the last one leaves the mip levels as they are
+    bool unchanged = false;
+    if (frameid >= 0 && mip_reuse)
+    {
+	uint64_t hash = frame_hash( frame_data( frameid ), vidsrc->bytesperframe() );
+	unchanged = (hash == mip_frame_hash);
+	mip_frame_hash = hash;
+    }
+
+    if (frameid < 0)
+	;
+    else if (zero_copy)
+    {
+	//
+	// the frame is already in a PBO, just hand the previous one back to the driver
+	// once the GPU has finished with it
+	//
+
+	if (zc_held >= 0)
+	{
+	    glClientWaitSync( zc_fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED );
+	    glDeleteSync( zc_fence );
+	    release_frame( zc_held );
+	}
+
+	PROFILE_BEGIN(texsubimage);
+	glBindBuffer( GL_PIXEL_UNPACK_BUFFER, zc_bufs[frameid] );
+	glBindTexture( GL_TEXTURE_2D, yuv_tex );
+	glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+	glTexSubImage2D( GL_TEXTURE_2D, 0, 0, 0, vidsrc->width() / 2, vidsrc->height(), GL_RGBA, GL_UNSIGNED_BYTE, 0 );
+	CHECK_GLERROR();
+	glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+	PROFILE_END(texsubimage);
+	if (latency) latency->mark( LAT_upload );
+
+	zc_fence = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+	zc_held = frameid;
+    }
+    else
+    {
+	//
+	// copy the video frame into the next pbo in the ring, which the GPU finished
+	// reading a couple of frames ago, so the copy overlaps the previous upload
+	//
+
+	PROFILE_BEGIN(upload);
+	void *pbo = upload->map();
+	CHECK_GLERROR();
+
+	memcpy( pbo, frame_data( frameid ), vidsrc->bytesperframe() );
+	release_frame( frameid );
+
+	upload->unmap();
+	CHECK_GLERROR();
+	PROFILE_END(upload);
+
+	PROFILE_BEGIN(texsubimage);
+	glBindTexture( GL_TEXTURE_2D, yuv_tex );
+	CHECK_GLERROR();
+
+	// define the texture using data at offset 0 in the PBO
+	glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+	glTexSubImage2D( GL_TEXTURE_2D, 0, 0, 0, vidsrc->width() / 2, vidsrc->height(), GL_RGBA, GL_UNSIGNED_BYTE, 0 );
+	CHECK_GLERROR();
+	PROFILE_END(texsubimage);
+	if (latency) latency->mark( LAT_upload );
+
+	upload->fence();
+    }
+
+    set_yuv_path();
+    if (yuv_direct)
+    {
+	if (frameid >= 0 && !unchanged) mip_built = 0;
+    }
+    else if (frameid >= 0 || rgb_stale)
+    {
+	//
+	// perform YUYV->RGB conversion into the RGB texture (via FBO)
+	//
+
+	PROFILE_BEGIN(yuv2rgb);
+	convert_yuv( yuv_tex, vidsrc->width(), vidsrc->height(), 0 );
+	PROFILE_END(yuv2rgb);
+
+	if (!unchanged || rgb_stale) mip_built = 0;
+	rgb_stale = false;
+    }
+
+    // further inputs go into the other layers as their frames come in
+    for (int k = 0; k < n_inputs; ++k)
+    {
+	video_input &in = inputs[k];
+	int id = in.thread->get();
+	if (id < 0) continue;
+
+	PROFILE_BEGIN(upload);
+	void *pbo = in.upload->map();
+	memcpy( pbo, in.thread->data( id ), in.src->bytesperframe() );
+	in.thread->release( id );
+	in.upload->unmap();
+	PROFILE_END(upload);
+
+	PROFILE_BEGIN(texsubimage);
+	glBindTexture( GL_TEXTURE_2D, in.yuv_tex );
+	glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+	glTexSubImage2D( GL_TEXTURE_2D, 0, 0, 0, in.src->width() / 2, in.src->height(), GL_RGBA, GL_UNSIGNED_BYTE, 0 );
+	CHECK_GLERROR();
+	PROFILE_END(texsubimage);
+	in.upload->fence();
+
+	PROFILE_BEGIN(yuv2rgb);
+	convert_yuv( in.yuv_tex, in.src->width(), in.src->height(), 1 + k );
+	PROFILE_END(yuv2rgb);
+	mip_built = 0;
+    }
+
+    if (use_mipmaps) build_mipmaps();
+
+    //
+    // render the RGB texture to the screen
+    //
+
+    PROFILE_BEGIN(fractal);
+    animate();
+
+    int rw, rh;
+    render_size( rw, rh );
+    if (rw < scr_w)
+    {
+	// the governor has us drawing smaller, then scaling up to the screen
+	if (lowres_w != scr_w || lowres_h != scr_h)
+	{
+	    if (!lowres_fb) glGenFramebuffers( 1, &lowres_fb );
+	    if (!lowres_tex) glGenTextures( 1, &lowres_tex );
+	    glBindTexture( GL_TEXTURE_2D, lowres_tex );
+	    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+	    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+	    glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA8, scr_w, scr_h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL );
+	    glBindFramebuffer( GL_FRAMEBUFFER, lowres_fb );
+	    glFramebufferTexture2D( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, lowres_tex, 0 );
+	    CheckFramebufferStatus();
+	    lowres_w = scr_w;
+	    lowres_h = scr_h;
+	}
+	glBindFramebuffer( GL_FRAMEBUFFER, lowres_fb );
+    }
+    else glBindFramebufferEXT( GL_FRAMEBUFFER_EXT, screen_fb );
+
+    if (progressive) draw_progressive( rw, rh, (rw < scr_w) ? lowres_fb : screen_fb );
+    else draw_fractal( rw, rh );
+
+    if (rw < scr_w)
+    {
+	glBindFramebuffer( GL_READ_FRAMEBUFFER, lowres_fb );
+	glBindFramebuffer( GL_DRAW_FRAMEBUFFER, screen_fb );
+	glBlitFramebuffer( 0, 0, rw, rh, 0, 0, scr_w, scr_h, GL_COLOR_BUFFER_BIT, GL_LINEAR );
+	glBindFramebuffer( GL_FRAMEBUFFER, screen_fb );
+	CHECK_GLERROR();
+    }
+    PROFILE_END(fractal);
+}
+
+//
+// fractal_program - the fractal program for the current settings and trip count
+//
+// Every variant comes from fractal_src with #defines in front of it.  JULIA
+// takes c from a uniform instead of the pixel.  POLES draws where the orbit
+// ends up instead of sampling the video along it.  BAILOUT stops fetching once
+// the orbit escapes past the squared radius bailout, adding what would only
+// alias to the mean colour in one fetch.  GRAD fetches with explicit
+// gradients so BAILOUT can break out of the loop; without it escaped pixels
+// keep fetching and drop the result.  YUYV samples and converts the packed
+// video in yuv_tex instead of rgb_tex.  LAYERS picks one of that many layers
+// of rgb_tex per pixel, or per trip with LAYER_BY_TRIP.  DEEP iterates the
+// offset from the reference orbit in orbit_tex, as span_deep() does, scaled
+// by deep_scale.  CACHE_BUILD writes the points trips cache_first on would
+// sample to render targets instead, two to each.  CACHED gathers along the
+// points in orbit_cache without iterating.  TRIPS fixes the loop count so the
+// driver can unroll it.
+//
+// Trip counts past max_fixed_trips, which the animated and governed
+// iteration counts run through, share a program that reads it from the
+// trips uniform.  alpha gets the fraction of trips that fetched, for
+// measure_fetches().
+//
+
+static const char fractal_src[] =
+	"#if defined(LAYERS) || defined(CACHED)\n"
+	"#extension GL_EXT_texture_array : enable\n"
+	"#endif\n"
+	"#ifdef GRAD\n"
+	"#extension GL_ARB_shader_texture_lod : enable\n"
+	"#ifdef LAYERS\n"
+	"#extension GL_EXT_gpu_shader4 : enable\n"
+	"#endif\n"
+	"#endif\n"
+	"#ifdef TRIPS\n"
+	"#define trips TRIPS\n"
+	"#else\n"
+	"uniform int trips;\n"
+	"#endif\n"
+	"uniform vec2 trans_scale;\n"
+	"#ifdef JULIA\n"
+	"uniform vec2 c;\n"
+	"#endif\n"
+	"#ifndef POLES\n"
+	"uniform float vid_aspect;\n"
+	"uniform float iter_scale;\n"
+	"uniform float lod_bias;\n"
+	"#ifdef YUYV\n"
+	"uniform sampler2D yuv_tex;\n"
+	"uniform vec2 size;\n"
+	"\n"
+	"vec3 yuyv_rgb( vec4 yuyv, float x )\n"
+	"{\n"
+	"   float y = 1.1643 * (mix( yuyv.r, yuyv.b, x ) - 0.0625);\n"
+	"   float u = yuyv.g - 0.5;\n"
+	"   float v = yuyv.a - 0.5;\n"
+	"   return( clamp( vec3( y + 1.5958 * v, y - 0.39173 * u - 0.81290 * v, y + 2.017 * u ), 0.0, 1.0 ) );\n"
+	"}\n"
+	"\n"
+	"// escaped orbits sample at inf, keep fract()'s nan out of mix()\n"
+	"#define FETCH(st) yuyv_rgb( texture2D( yuv_tex, st ), clamp( fract( (st).x * size.x * 0.5 ), 0.0, 1.0 ) )\n"
+	"#define FETCH_GRAD(st, dx, dy) yuyv_rgb( texture2DGradARB( yuv_tex, st, dx, dy ), clamp( fract( (st).x * size.x * 0.5 ), 0.0, 1.0 ) )\n"
+	"#define FETCH_MEAN yuyv_rgb( texture2D( yuv_tex, vec2( 0.5 ), 32.0 ), 0.5 )\n"
+	"#elif defined(LAYERS)\n"
+	"uniform sampler2DArray rgb_tex;\n"
+	"\n"
+	"// which input a point samples, by tile of the plane or by trip\n"
+	"float layer( vec2 st, int i )\n"
+	"{\n"
+	"#ifdef LAYER_BY_TRIP\n"
+	"   float l = mod( float(i), float(LAYERS) );\n"
+	"#else\n"
+	"   float l = mod( floor( st.x ) + floor( st.y ), float(LAYERS) );\n"
+	"#endif\n"
+	"   // escaped orbits sample at inf, keep the nan off the layer index\n"
+	"   return( (l >= 0.0 && l < float(LAYERS)) ? l : 0.0 );\n"
+	"}\n"
+	"\n"
+	"vec3 mean_rgb()\n"
+	"{\n"
+	"   vec3 m = vec3( 0.0 );\n"
+	"   for (int l = 0; l < LAYERS; ++l) m += texture2DArray( rgb_tex, vec3( 0.5, 0.5, float(l) ), 32.0 ).rgb;\n"
+	"   return( m / float(LAYERS) );\n"
+	"}\n"
+	"#define FETCH(st) texture2DArray( rgb_tex, vec3( st, layer( st, i ) ), lod_bias ).rgb\n"
+	"#define FETCH_GRAD(st, dx, dy) texture2DArrayGrad( rgb_tex, vec3( st, layer( st, i ) ), lod_scale * (dx), lod_scale * (dy) ).rgb\n"
+	"#define FETCH_MEAN mean_rgb()\n"
+	"#else\n"
+	"uniform sampler2D rgb_tex;\n"
+	"#define FETCH(st) texture2D( rgb_tex, st, lod_bias ).rgb\n"
+	"#define FETCH_GRAD(st, dx, dy) texture2DGradARB( rgb_tex, st, lod_scale * (dx), lod_scale * (dy) ).rgb\n"
+	"#define FETCH_MEAN texture2D( rgb_tex, vec2( 0.5 ), 32.0 ).rgb\n"
+	"#endif\n"
+	"#endif\n"
+	"#ifdef BAILOUT\n"
+	"uniform float bailout;\n"
+	"#endif\n"
+	"#ifdef DEEP\n"
+	"uniform sampler2D orbit;\n"
+	"uniform int orbit_len;\n"
+	"uniform vec2 deep_scale;\n"
+	"uniform float unscale_at;\n"
+	"\n"
+	"// reference orbit entry n, hi in xy and lo in zw\n"
+	"vec4 ref( int n )\n"
+	"{\n"
+	"   return( texture2D( orbit, vec2( (float(n) + 0.5) / float(DEEP), 0.5 ) ) );\n"
+	"}\n"
+	"\n"
+	"#ifdef GRAD\n"
+	"#define UNSCALE_GRAD gx *= deep_scale.x; gx *= deep_scale.y; gy *= deep_scale.x; gy *= deep_scale.y; \\\n"
+	"    dcx *= deep_scale.x; dcx *= deep_scale.y; dcy *= deep_scale.x; dcy *= deep_scale.y;\n"
+	"#else\n"
+	"#define UNSCALE_GRAD\n"
+	"#endif\n"
+	"#define UNSCALE d *= deep_scale.x; d *= deep_scale.y; dc *= deep_scale.x; dc *= deep_scale.y; UNSCALE_GRAD scaled = false\n"
+	"#endif\n"
+	"#define CMUL(a, b) vec2( (a).x * (b).x - (a).y * (b).y, (a).x * (b).y + (a).y * (b).x )\n"
+	"// sample point left in the cache for trips after the orbit escaped\n"
+	"#define ESCAPED -1.0e30\n"
+	"#ifdef CACHE_BUILD\n"
+	"uniform int cache_first;\n"
+	"#endif\n"
+	"#ifdef CACHED\n"
+	"uniform sampler2DArray orbit_cache;\n"
+	"uniform vec2 cache_size;\n"
+	"#ifdef BAILOUT\n"
+	"// no break: the fetches after one would be in non-uniform control flow\n"
+	"#define GATHER(st) if (!escaped && (st).x <= ESCAPED) { escaped = true; rgb += float(trips - i) * mean; fetches += 1.0; } \\\n"
+	"    f = FETCH( st ); if (!escaped) { rgb += f; fetches += 1.0; }\n"
+	"#else\n"
+	"#define GATHER(st) rgb += FETCH( st ); fetches += 1.0\n"
+	"#endif\n"
+	"#endif\n"
+	"\n"
+	"void main( void )\n"
+	"{\n"
+	"#ifdef CACHED\n"
+	"   // the orbit's sample points, two trips to a layer\n"
+	"   vec2 cache_st = gl_FragCoord.xy / cache_size;\n"
+	"   vec3 rgb = vec3( 0.0 );\n"
+	"   float fetches = 0.0;\n"
+	"#ifdef BAILOUT\n"
+	"   vec3 mean = FETCH_MEAN, f;\n"
+	"   bool escaped = false;\n"
+	"#endif\n"
+	"   for (int i = 0; i < trips; ++i)\n"
+	"   {\n"
+	"       vec4 o = texture2DArray( orbit_cache, vec3( cache_st, float(i / 2) ) );\n"
+	"       GATHER( o.xy );\n"
+	"       if (++i == trips) break;\n"
+	"       GATHER( o.zw );\n"
+	"   }\n"
+	"   gl_FragColor.rgb = rgb * iter_scale;\n"
+	"   gl_FragColor.a = fetches / float(trips);\n"
+	"#else\n"
+	"   vec2 p = gl_TexCoord[0].yx;\n"
+	"#ifdef DEEP\n"
+	"   // p is the offset from the reference in units of deep_scale.x * deep_scale.y,\n"
+	"   // and stays that way, dropping d * d, until it is big enough for a float\n"
+	"   vec2 d = p;\n"
+	"#ifdef JULIA\n"
+	"   vec2 dc = vec2( 0.0 );\n"
+	"#else\n"
+	"   vec2 dc = trans_scale * d;\n"
+	"#endif\n"
+	"#endif\n"
+	"#ifdef GRAD\n"
+	"   // the orbit's derivatives across the screen, carried along with it\n"
+	"   // by the chain rule.  Breaking out of the loop on escape leaves the\n"
+	"   // fetches after it in non-uniform control flow, where the implicit\n"
+	"   // derivatives, and so the mip level, aren't defined once a\n"
+	"   // neighbouring pixel has left\n"
+	"   vec2 gx = dFdx( p ), gy = dFdy( p );\n"
+	"#ifdef JULIA\n"
+	"   vec2 dcx = vec2( 0.0 ), dcy = vec2( 0.0 );\n"
+	"#else\n"
+	"   vec2 dcx = trans_scale * gx, dcy = trans_scale * gy;\n"
+	"#endif\n"
+	"   float lod_scale = exp2( lod_bias );\n"
+	"#endif\n"
+	"#ifdef DEEP\n"
+	"   bool scaled = true;\n"
+	"   if (max( abs( d.x ), abs( d.y ) ) >= unscale_at) { UNSCALE; }\n"
+	"   vec4 z0 = ref( 0 );\n"
+	"   vec4 zm = z0;\n"
+	"   int m = 0;\n"
+	"#elif defined(JULIA)\n"
+	"   vec2 cc = trans_scale * c;\n"
+	"#else\n"
+	"   vec2 cc = trans_scale * p;\n"
+	"#endif\n"
+	"#ifndef POLES\n"
+	"   vec3 rgb = vec3( 0.0 );\n"
+	"   float fetches = 0.0;\n"
+	"#endif\n"
+	"#if defined(BAILOUT) && !defined(POLES) && !defined(CACHE_BUILD)\n"
+	"   vec3 mean = FETCH_MEAN;\n"
+	"#ifndef GRAD\n"
+	"   vec3 f;\n"
+	"   bool escaped = false;\n"
+	"#endif\n"
+	"#endif\n"
+	"#ifdef CACHE_BUILD\n"
+	"   vec4 o[CACHE_BUILD];\n"
+	"   for (int t = 0; t < CACHE_BUILD; ++t) o[t] = vec4( ESCAPED );\n"
+	"#endif\n"
+	"\n"
+	"   for (int i = 0; i < trips; ++i)\n"
+	"   {\n"
+	"#ifdef DEEP\n"
+	"       // z = Z_m + d, d' = (2 Z_m + d) d + dc\n"
+	"       vec2 a = 2.0 * zm.xy + (scaled ? vec2( 0.0 ) : d);\n"
+	"#ifdef GRAD\n"
+	"       // d/dx of d' is (2 Z_m + 2 d) d/dx of d + d/dx of dc\n"
+	"       vec2 b = 2.0 * zm.xy + (scaled ? vec2( 0.0 ) : 2.0 * d);\n"
+	"       gx = CMUL( b, gx ) + dcx;\n"
+	"       gy = CMUL( b, gy ) + dcy;\n"
+	"#endif\n"
+	"       d = CMUL( a, d ) + dc;\n"
+	"       if (scaled && max( abs( d.x ), abs( d.y ) ) >= unscale_at) { UNSCALE; }\n"
+	"       zm = ref( ++m );\n"
+	"       p = zm.xy + (zm.zw + (scaled ? vec2( 0.0 ) : d));\n"
+	"       // rebase onto Z_0 when the orbit passes closer to 0 than d, or the reference runs out\n"
+	"       if (m == orbit_len - 1 || (!scaled && dot( p, p ) < dot( d, d )))\n"
+	"       {\n"
+	"           if (scaled) { UNSCALE; }\n"
+	"           d = (p - z0.xy) - z0.zw;\n"
+	"           zm = z0;\n"
+	"           m = 0;\n"
+	"       }\n"
+	"#else\n"
+	"#ifdef GRAD\n"
+	"       gx = 2.0 * CMUL( p, gx ) + dcx;\n"
+	"       gy = 2.0 * CMUL( p, gy ) + dcy;\n"
+	"#endif\n"
+	"       p = vec2( p.x * p.x - p.y * p.y + cc.x, 2.0 * p.x * p.y + cc.y );\n"
+	"#endif\n"
+	"#ifdef CACHE_BUILD\n"
+	"#ifdef BAILOUT\n"
+	"       if (dot( p, p ) > bailout) break;\n"
+	"#endif\n"
+	"       // this pass keeps trips cache_first on, two to a target\n"
+	"       int k = i - cache_first;\n"
+	"       if (k >= 0)\n"
+	"       {\n"
+	"           vec2 st = vec2( p.y + 0.5, (p.x * vid_aspect) + 0.5 );\n"
+	"           if (k == 2 * (k / 2)) o[k / 2].xy = st;\n"
+	"           else o[k / 2].zw = st;\n"
+	"           if (k == 2 * CACHE_BUILD - 1) break;\n"
+	"       }\n"
+	"#elif defined(GRAD)\n"
+	"       if (dot( p, p ) > bailout)\n"
+	"       {\n"
+	"           rgb += float(trips - i) * mean;\n"
+	"           fetches += 1.0;\n"
+	"           break;\n"
+	"       }\n"
+	"#ifdef DEEP\n"
+	"       // while scaled, p is the reference alone, the same for every pixel\n"
+	"       vec2 sx = scaled ? vec2( 0.0 ) : gx, sy = scaled ? vec2( 0.0 ) : gy;\n"
+	"#else\n"
+	"       vec2 sx = gx, sy = gy;\n"
+	"#endif\n"
+	"       rgb += FETCH_GRAD( vec2(p.y + 0.5, (p.x * vid_aspect) + 0.5), vec2( sx.y, sx.x * vid_aspect ), vec2( sy.y, sy.x * vid_aspect ) );\n"
+	"       fetches += 1.0;\n"
+	"#elif defined(BAILOUT) && !defined(POLES)\n"
+	"       // without explicit gradients every pixel fetches every trip, and escaped ones drop theirs\n"
+	"       if (!escaped && dot( p, p ) > bailout)\n"
+	"       {\n"
+	"           escaped = true;\n"
+	"           rgb += float(trips - i) * mean;\n"
+	"           fetches += 1.0;\n"
+	"       }\n"
+	"       f = FETCH( vec2(p.y + 0.5, (p.x * vid_aspect) + 0.5) );\n"
+	"       if (!escaped)\n"
+	"       {\n"
+	"           rgb += f;\n"
+	"           fetches += 1.0;\n"
+	"       }\n"
+	"#elif !defined(POLES)\n"
+	"       rgb += FETCH( vec2(p.y + 0.5, (p.x * vid_aspect) + 0.5) );\n"
+	"       fetches += 1.0;\n"
+	"#endif\n"
+	"   }\n"
+	"\n"
+	"#ifdef POLES\n"
+	"   float len = length(p);\n"
+	"   float r = (len > 0.0) ? (1.0 / len) : 0.0;\n"
+	"   p *= r;\n"
+	"   gl_FragColor.rg = 0.5 * (p + 1.0);\n"
+	"   gl_FragColor.b = (r < 1.0) ? r : len;\n"
+	"#elif defined(CACHE_BUILD)\n"
+	"   for (int t = 0; t < CACHE_BUILD; ++t) gl_FragData[t] = o[t];\n"
+	"#else\n"
+	"   gl_FragColor.rgb = rgb * iter_scale;\n"
+	"   gl_FragColor.a = fetches / float(trips);\n"
+	"#endif\n"
+	"#endif\n"
+	"}\n";
+
+static gl_program *fractal_program( int trips, orbit_use use )
+{
+    // building the cache only needs the orbit, gathering from it only the video
+    bool bail = bailout && !showpoles;
+    int fixed = (trips <= max_fixed_trips) ? trips : 0;
+    bool yuyv = yuv_direct && !showpoles && ORBITS_BUILD != use;
+    bool layers = n_inputs && !yuyv && !showpoles && ORBITS_BUILD != use;
+    bool by_trip = layers && layer_by_trip;
+    bool julia = juliaing && ORBITS_CACHED != use;
+    bool deep = deeping() && ORBITS_CACHED != use;
+    // the cache has no gradients to give, so gathering from it masks instead
+    bool grad = bail && ORBITS_LIVE == use && (layers ? bailout_grad_array : bailout_grad);
+    gl_program *&prog = fractal_progs[yuyv][julia][showpoles][bail][by_trip][deep][use][fixed];
+    if (prog) return( prog );
+
+    char defines[256];
+    int len = 0;
+    if (yuyv) len += sprintf( defines + len, "#define YUYV\n" );
+    if (layers) len += sprintf( defines + len, "#define LAYERS %d\n", 1 + n_inputs );
+    if (by_trip) len += sprintf( defines + len, "#define LAYER_BY_TRIP\n" );
+    if (julia) len += sprintf( defines + len, "#define JULIA\n" );
+    if (showpoles) len += sprintf( defines + len, "#define POLES\n" );
+    if (bail) len += sprintf( defines + len, "#define BAILOUT\n" );
+    if (grad) len += sprintf( defines + len, "#define GRAD\n" );
+    if (deep) len += sprintf( defines + len, "#define DEEP %d\n", max_orbit );
+    if (ORBITS_BUILD == use) len += sprintf( defines + len, "#define CACHE_BUILD %d\n", cache_targets );
+    if (ORBITS_CACHED == use) len += sprintf( defines + len, "#define CACHED\n" );
+    if (fixed) len += sprintf( defines + len, "#define TRIPS %d\n", fixed );
+
+    char *src = new char[len + sizeof(fractal_src)];
+    strcpy( src, defines );
+    strcpy( src + len, fractal_src );
+    prog = programs->get( src );
+    delete [] src;
+
+    static const char *uses[] = { "", " cache build", " cached" };
+    if (verbose) DBUG(( "built fractal program%s%s%s%s%s%s%s, %d trips", yuyv ? " yuyv" : "", layers ? " layers" : "",
+	julia ? " julia" : "", showpoles ? " poles" : "", bail ? " bailout" : "", deep ? " deep" : "", uses[use], fixed ));
+
+    glUseProgram( prog->id );
+    glUniform1i( prog->loc[U_rgb_tex], 0 );
+    glUniform1i( prog->loc[U_yuv_tex], 0 );
+    glUniform1i( prog->loc[U_orbit], 1 );
+    glUniform1i( prog->loc[U_orbit_cache], 2 );
+    return( prog );
+}
+
+//
+// upload_orbit - bring orbit_tex up to date with the reference orbit for this view
+//
+
+static void upload_orbit( int trips )
+{
+    reference_orbit( trips );
+    glActiveTexture( GL_TEXTURE1 );
+    if (!orbit_tex)
+    {
+	glGenTextures( 1, &orbit_tex );
+	glBindTexture( GL_TEXTURE_2D, orbit_tex );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+	glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA32F, max_orbit, 1, 0, GL_RGBA, GL_FLOAT, NULL );
+    }
+    else glBindTexture( GL_TEXTURE_2D, orbit_tex );
+    if (orbit_stale)
+    {
+	glTexSubImage2D( GL_TEXTURE_2D, 0, 0, 0, deep_orbit_len, 1, GL_RGBA, GL_FLOAT, deep_orbit_f );
+	orbit_stale = false;
+    }
+    glActiveTexture( GL_TEXTURE0 );
+    CHECK_GLERROR();
+}
+
+//
+// fractal_pass - run a fractal program over a w x h viewport of the bound framebuffer
+//
+// With a part, only the view's pixels it picks out are drawn, and the mip
+// level selection is biased back by how far apart they are spread.  A cache
+// build pass writes trips first on.
+//
+
+static void fractal_pass( int w, int h, int trips, float iter_scale, const view_part *part, orbit_use use, int first )
+{
+    setviewport( w, h );
+
+    glMatrixMode( GL_MODELVIEW );
+    glLoadIdentity();
+
+    gl_program *prog = fractal_program( trips, use );
+
+    glUseProgram( prog->id );
+    if (juliaing) glUniform2f( prog->loc[U_c], jx, jy );
+
+    float tpx, tpy;
+    trans_uniform( tpx, tpy );
+    glUniform2f( prog->loc[U_trans_scale], tpx, tpy );
+    glUniform1f( prog->loc[U_iter_scale], iter_scale );
+    glUniform1i( prog->loc[U_trips], trips );
+    glUniform1f( prog->loc[U_bailout], bailout_radius * bailout_radius );
+    // the video size can change under a program with recapture()
+    glUniform2f( prog->loc[U_size], GLfloat(vidsrc->width()), GLfloat(vidsrc->height()) );
+    glUniform1f( prog->loc[U_vid_aspect], vid_aspect );
+    glUniform1f( prog->loc[U_lod_bias], part ? -log2f( part->spread ) : 0.0f );
+    glUniform1i( prog->loc[U_cache_first], first );
+    if (ORBITS_CACHED == use)
+    {
+	glUniform2f( prog->loc[U_cache_size], GLfloat(w), GLfloat(h) );
+	glActiveTexture( GL_TEXTURE2 );
+	glBindTexture( GL_TEXTURE_2D_ARRAY, cache_tex );
+	glActiveTexture( GL_TEXTURE0 );
+    }
+
+    glBindTexture( video_target(), video_tex() );
+    glTexEnvi( GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE );
+    GLint wrap = mirror ? GL_MIRRORED_REPEAT : GL_REPEAT;
+    if (wrap != video_wrap)
+    {
+	glTexParameteri( video_target(), GL_TEXTURE_WRAP_S, wrap );
+	glTexParameteri( video_target(), GL_TEXTURE_WRAP_T, wrap );
+	video_wrap = wrap;
+    }
+    glEnable( GL_TEXTURE_2D );
+
+    // deep zoom draws the offsets from the center in units of deep_scale
+    GLfloat x = GLfloat(cx), y = GLfloat(cy), z = GLfloat(zoom);
+    if (deeping())
+    {
+	if (ORBITS_CACHED != use) upload_orbit( trips );
+	int e;
+	z = frexp( zoom, &e );
+	x = y = 0;
+	glUniform1i( prog->loc[U_orbit_len], deep_orbit_len );
+	glUniform2f( prog->loc[U_deep_scale], ldexpf( 1.0f, e / 2 ), ldexpf( 1.0f, e - e / 2 ) );
+	// d stays scaled below 2^-40, where d * d is lost next to 2 Z d anyway
+	glUniform1f( prog->loc[U_unscale_at], ldexpf( 1.0f, -40 - e ) );
+    }
+    if (part)
+    {
+	static const GLfloat verts[3][2] = { { -3, 1 }, { 1, 1 }, { 1, -3 } };
+	glBegin( GL_TRIANGLES );
+	for (int k = 0; k < 3; ++k)
+	{
+	    GLfloat vx = part->scale[0] * verts[k][0] + part->offset[0];
+	    GLfloat vy = part->scale[1] * verts[k][1] + part->offset[1];
+	    glTexCoord2f( x + z * vx, y - z * scr_aspect * vy );
+	    glVertex2f( verts[k][0], verts[k][1] );
+	}
+	glEnd();
+	CHECK_GLERROR();
+	return;
+    }
+
+    GLfloat left = x - z;
+    GLfloat right = x + z;
+    GLfloat top = y - z * scr_aspect;
+    GLfloat bottom = y + z * scr_aspect;
+
+    glBegin( GL_TRIANGLES );
+	glTexCoord2f( left - (2 * z),  top );
+	glVertex2f( -3,  1 );
+	glTexCoord2f( right, top );
+	glVertex2f(  1,  1 );
+	glTexCoord2f( right, bottom + (2 * z) * scr_aspect );
+	glVertex2f(  1, -3 );
+    glEnd();
+    CHECK_GLERROR();
+}
+
+//
+// update_orbit_cache - bring cache_tex up to date with the orbits of a w x h view, false to draw it live
+//
+// Where each pixel's orbit samples the video only depends on the view, so
+// while it holds still the orbits are iterated once into cache_tex and every
+// frame after that just gathers along them.  A view that changed since the
+// last frame is likely being dragged or animated and is drawn live rather
+// than rebuilt every frame, as is one whose cache would take more than
+// max_cache_mb.  The build is spread over frames: each frame runs one pass
+// that writes the next cache_targets layers, iterating up to the last trip
+// it keeps, and the view is drawn live on top of that until the last layer
+// is in.  So a change costs trips / (2 * cache_targets) frames, rounded up,
+// of a live frame plus one build pass each, before the cache takes over.
+//
 
-static GLuint yuv_tex = 0;			// YUYV source texture
-static GLuint rgb_tex = 0;			// converted RGB texture
-static GLuint feedback_tex = 0;			// feedback rendering buffer
-static GLuint fb = 0;				// FBO for YUV->RGB convert
-static GLuint feedback_fb = 0;			// FBO for feedback rendering path
-static GLuint yuv_prog = 0;			// program for YUYV->RGB conversion
-static GLuint yuv_buf = 0;			// PBO for video data copy to yuv_tex
-static GLuint mand_prog = 0;			// program to show mandelbrot set mapping
-static GLuint mandpole_prog = 0;		// program to show mandelbrot set poles
-static GLuint julia_prog = 0;			// program to show julia set mapping
-static GLuint juliapole_prog = 0;		// program to show julia set poles
+static bool update_orbit_cache( int w, int h, int trips )
+{
+    struct cache_key
+    {
+	deep_real	cx, cy;
+	double		zoom;
+	float		tpx, tpy, jx, jy, bailout, vid_aspect;
+	int		trips, w, h;
+	bool		julia, deep;
+    };
+    static cache_key last, built;
+    static bool fits = false;
+    static int built_layers = 0;		// of built's layers, how many are in cache_tex
+    // value-initialised, which zeroes the padding memcmp() sees too
+    cache_key key = cache_key();
+    key.cx = cx;
+    key.cy = cy;
+    key.zoom = zoom;
+    trans_uniform( key.tpx, key.tpy );
+    key.jx = juliaing ? jx : 0;
+    key.jy = juliaing ? jy : 0;
+    key.bailout = bailout ? bailout_radius : 0;
+    key.vid_aspect = vid_aspect;
+    key.trips = trips;
+    key.w = w;
+    key.h = h;
+    key.julia = juliaing;
+    key.deep = deeping();
+    if (memcmp( &key, &last, sizeof(key) ))
+    {
+	last = key;
+	return( false );
+    }
+    int layers = (trips + 1) / 2;
+    if (memcmp( &key, &built, sizeof(key) ))
+    {
+	built = key;
+	built_layers = 0;
+	fits = cache_targets && layers <= max_cache_layers && 16.0 * w * h * layers <= max_cache_mb * 1048576;
+    }
+    if (!fits) return( false );
+    if (built_layers >= layers) return( true );
+    if (w != cache_w || h != cache_h || layers != cache_layers)
+    {
+	if (!cache_fb) glGenFramebuffers( 1, &cache_fb );
+	if (!cache_tex) glGenTextures( 1, &cache_tex );
+	glBindTexture( GL_TEXTURE_2D_ARRAY, cache_tex );
+	glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+	glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+	glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+	glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+	glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 0 );
+	glTexImage3D( GL_TEXTURE_2D_ARRAY, 0, GL_RGBA32F, w, h, layers, 0, GL_RGBA, GL_FLOAT, NULL );
+	CHECK_GLERROR();
+	cache_w = w;
+	cache_h = h;
+	cache_layers = layers;
+	if (verbose) DBUG(( "orbit cache %dx%d, %d layers, %.1f MB", w, h, layers, 16.0 * w * h * layers / 1048576 ));
+    }
+
+    // this frame's pass, the next cache_targets layers
+    GLint bound = 0;
+    glGetIntegerv( GL_FRAMEBUFFER_BINDING, &bound );
+    glBindFramebuffer( GL_FRAMEBUFFER, cache_fb );
+    int first = built_layers;
+    GLenum buffers[max_cache_targets];
+    for (int t = 0; t < cache_targets; ++t)
+    {
+	bool used = first + t < layers;
+	glFramebufferTextureLayer( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + t, used ? cache_tex : 0, 0, used ? first + t : 0 );
+	buffers[t] = used ? GL_COLOR_ATTACHMENT0 + t : GL_NONE;
+    }
+    glDrawBuffers( cache_targets, buffers );
+    CheckFramebufferStatus();
+    fractal_pass( w, h, trips, 0, NULL, ORBITS_BUILD, 2 * first );
+    built_layers += cache_targets;
+    glBindFramebuffer( GL_FRAMEBUFFER, bound );
+    CHECK_GLERROR();
+    // the pass that finishes it can be gathered from straight away
+    return( built_layers >= layers );
+}
 
 //
-// CheckFramebufferStatus - see if we setup the framebuffer correctly or not
+// draw_fractal - draw the fractal over a w x h viewport of the bound framebuffer
+//
+// Whole views go through the orbit cache when it is on and can hold them.
 //
 
-void CheckFramebufferStatus()
+static void draw_fractal( int w, int h, const view_part *part )
 {
-    switch (glCheckFramebufferStatusEXT( GL_FRAMEBUFFER_EXT ))
+    float iter_scale = 1.0f / render_iterations();
+    int trips = shader_trips( iter_scale );
+    bool cached = orbit_caching && !part && !showpoles && update_orbit_cache( w, h, trips );
+    fractal_pass( w, h, trips, iter_scale, part, cached ? ORBITS_CACHED : ORBITS_LIVE, 0 );
+}
+
+//
+// draw_progressive - draw the fractal a quarter of the pixels per frame into a w x h viewport of target
+//
+// Pixels are split into four phases by where they sit in each 2x2 block,
+// and each phase is drawn at half resolution into its own layer of
+// phase_tex, one phase per frame, then interleaved back together.  A change
+// to anything the fractal depends on starts over from a single phase,
+// scaled up to stand in for the other three, so panning and zooming cost a
+// quarter of a frame and full resolution is back four frames after the view
+// stops.  The phases keep taking turns after that, each one showing the
+// video as of its last turn.
+//
+
+static const char composite_src[] =
+	"#extension GL_EXT_texture_array : enable\n"
+	"uniform sampler2DArray phases;\n"
+	"uniform vec2 size;\n"
+	"uniform vec4 valid;\n"
+	"uniform float base_phase;\n"
+	"\n"
+	"void main( void )\n"
+	"{\n"
+	"   vec2 xy = floor( gl_FragCoord.xy );\n"
+	"   vec2 s = mod( xy, 2.0 );\n"
+	"   float phase = s.x + 2.0 * s.y;\n"
+	"   // pixels of phases not drawn since the view changed scale up the one that was first\n"
+	"   if (dot( valid, vec4( equal( vec4( phase ), vec4( 0.0, 1.0, 2.0, 3.0 ) ) ) ) == 0.0) phase = base_phase;\n"
+	"   vec2 ps = vec2( mod( phase, 2.0 ), floor( phase * 0.5 ) );\n"
+	"   gl_FragColor = texture2DArray( phases, vec3( ((xy - ps) * 0.5 + 0.5) / size, phase ) );\n"
+	"}\n";
+
+static void draw_progressive( int w, int h, GLuint target )
+{
+    struct view_key
     {
-    case GL_FRAMEBUFFER_COMPLETE_EXT:
-        break;
-    case GL_FRAMEBUFFER_UNSUPPORTED_EXT:
-        printf( "Unsupported framebuffer format\n" );
-        break;
-    case GL_FRAMEBUFFER_INCOMPLETE_ATTACHMENT_EXT:
-        printf( "Framebuffer incomplete, incomplete attachment\n" );
-    	break;
-    case GL_FRAMEBUFFER_INCOMPLETE_MISSING_ATTACHMENT_EXT:
-        printf( "Framebuffer incomplete, missing attachment\n" );
-        break;
-    case GL_FRAMEBUFFER_INCOMPLETE_DUPLICATE_ATTACHMENT_EXT:
-        printf( "Framebuffer incomplete, duplicate attachment\n" );
-        break;
-    case GL_FRAMEBUFFER_INCOMPLETE_DIMENSIONS_EXT:
-        printf( "Framebuffer incomplete, attached images must have same dimensions\n" );
-        break;
-    case GL_FRAMEBUFFER_INCOMPLETE_FORMATS_EXT:
-        printf( "Framebuffer incomplete, attached images must have same format\n" );
-        break;
-    case GL_FRAMEBUFFER_INCOMPLETE_DRAW_BUFFER_EXT:
-        printf( "Framebuffer incomplete, missing draw buffer\n" );
-        break;
-    case GL_FRAMEBUFFER_INCOMPLETE_READ_BUFFER_EXT:
-        printf( "Framebuffer incomplete, missing read buffer\n" );
-        break;
-    default:
-    	FAIL(( "Unknown frambuffer status 0x%04x!\n", glCheckFramebufferStatusEXT( GL_FRAMEBUFFER_EXT ) ));
+	deep_real	cx, cy;
+	double		zoom;
+	float		trans_scale, trans_phase, jx, jy;
+	int		iterations, w, h;
+	bool		julia, poles, mirror, bailout, yuyv, by_trip, deep;
+    };
+    static view_key last;
+    // value-initialised, which zeroes the padding memcmp() sees too
+    view_key key = view_key();
+    key.cx = cx;
+    key.cy = cy;
+    key.zoom = zoom;
+    key.trans_scale = trans_scale;
+    key.trans_phase = trans_phase;
+    key.jx = juliaing ? jx : 0;
+    key.jy = juliaing ? jy : 0;
+    key.iterations = render_iterations();
+    key.w = w;
+    key.h = h;
+    key.julia = juliaing;
+    key.poles = showpoles;
+    key.mirror = mirror;
+    key.bailout = bailout;
+    key.yuyv = yuv_direct;
+    key.by_trip = layer_by_trip;
+    key.deep = deeping();
+    if (memcmp( &key, &last, sizeof(key) ))
+    {
+	last = key;
+	phase_valid = 0;
+	phase_next = 0;
+    }
+
+    int pw = (w + 1) / 2, ph = (h + 1) / 2;
+    if (pw != phase_w || ph != phase_h)
+    {
+	if (!phase_fb) glGenFramebuffers( 1, &phase_fb );
+	if (!phase_tex) glGenTextures( 1, &phase_tex );
+	glBindTexture( GL_TEXTURE_2D_ARRAY, phase_tex );
+	glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+	glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+	glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+	glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+	glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 0 );
+	glTexImage3D( GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, pw, ph, 4, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL );
+	CHECK_GLERROR();
+	phase_w = pw;
+	phase_h = ph;
     }
+    if (!composite_prog)
+    {
+	composite_prog = programs->get( composite_src );
+	glUseProgram( composite_prog->id );
+	glUniform1i( composite_prog->loc[U_phases], 0 );
+    }
+
+    // diagonal neighbours first, so the second frame already halves the gaps
+    static const int order[4] = { 0, 3, 1, 2 };
+    int phase = order[phase_next];
+    phase_next = (phase_next + 1) & 3;
+    if (!phase_valid) phase_base = phase;
+
+    // the half resolution pixel centers of this phase in the full view's clip coordinates
+    view_part part;
+    part.scale[0] = 2.0f * pw / w;
+    part.offset[0] = part.scale[0] - 1 + (2 * (phase & 1) - 1) / GLfloat(w);
+    part.scale[1] = 2.0f * ph / h;
+    part.offset[1] = part.scale[1] - 1 + (2 * (phase >> 1) - 1) / GLfloat(h);
+    part.spread = 2;
+
+    glBindFramebuffer( GL_FRAMEBUFFER, phase_fb );
+    glFramebufferTextureLayer( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, phase_tex, 0, phase );
+    CheckFramebufferStatus();
+    draw_fractal( pw, ph, &part );
+    phase_valid |= 1 << phase;
+
+    glBindFramebuffer( GL_FRAMEBUFFER, target );
+    setviewport( w, h );
+    glMatrixMode( GL_MODELVIEW );
+    glLoadIdentity();
+    glUseProgram( composite_prog->id );
+    glUniform2f( composite_prog->loc[U_size], GLfloat(pw), GLfloat(ph) );
+    glUniform4f( composite_prog->loc[U_valid], phase_valid & 1, (phase_valid >> 1) & 1, (phase_valid >> 2) & 1, (phase_valid >> 3) & 1 );
+    glUniform1f( composite_prog->loc[U_base_phase], phase_base );
+    glBindTexture( GL_TEXTURE_2D_ARRAY, phase_tex );
+
+    glBegin( GL_TRIANGLES );
+	glVertex2f( -3,  1 );
+	glVertex2f(  1,  1 );
+	glVertex2f(  1, -3 );
+    glEnd();
+    CHECK_GLERROR();
 }
 
 //
-// elapsed_ms - return milliseconds of elapsed time since last call
+// measure_fetches - average texture fetches per pixel in the current view
+//
+// The cpu renderer counts them as it goes.  The GL programs leave the
+// fraction of trips that fetched in alpha, so redraw the view at a sixteenth
+// of the pixels into a scratch FBO and average that.
 //
 
-float elapsed_ms()
+static float measure_fetches()
 {
-    static struct timeval otp;
-    static bool bCalled = false;
-    struct timeval tp;
+    static GLuint stats_fb = 0, stats_tex = 0;
+    static int stats_w = 0, stats_h = 0;
+    static unsigned char *stats = NULL;
 
-    gettimeofday( &tp, NULL );
+    if (cpu) return( cpu->fetches() );
+    if (showpoles) return( 0 );
+    int trips = shader_trips( 1.0f / render_iterations() );
+    if (!bailout) return( trips );
 
-    float ms = bCalled ? (((tp.tv_sec - otp.tv_sec) * 1.0e3f) + ((tp.tv_usec - otp.tv_usec) * 1.0e-3f)) : 0.0f;
-    bCalled = true;
-    otp = tp;
-    return( ms );
+    int w = (scr_w + 3) / 4, h = (scr_h + 3) / 4;
+    if (w != stats_w || h != stats_h)
+    {
+	if (!stats_fb) glGenFramebuffers( 1, &stats_fb );
+	if (!stats_tex) glGenTextures( 1, &stats_tex );
+	glBindTexture( GL_TEXTURE_2D, stats_tex );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+	glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL );
+	glBindFramebuffer( GL_FRAMEBUFFER, stats_fb );
+	glFramebufferTexture2D( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, stats_tex, 0 );
+	CheckFramebufferStatus();
+	delete [] stats;
+	stats = new unsigned char[w * h * 4];
+	stats_w = w;
+	stats_h = h;
+    }
+
+    // drawn as a part of the view so it doesn't go through the orbit cache at this size
+    static const view_part whole = { { 1, 1 }, { 0, 0 }, 1 };
+    glBindFramebuffer( GL_FRAMEBUFFER, stats_fb );
+    draw_fractal( w, h, &whole );
+    glPixelStorei( GL_PACK_ALIGNMENT, 4 );
+    glReadPixels( 0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, stats );
+    glBindFramebuffer( GL_FRAMEBUFFER, screen_fb );
+    CHECK_GLERROR();
+
+    double sum = 0;
+    for (int i = 0; i < w * h; ++i) sum += stats[4 * i + 3];
+    return( float(sum * trips / (255.0 * w * h)) );
 }
 
 //
-// make_frag_prog - create a fragment-program only shader
+// render_frame - render one frame with whichever renderer is in use
 //
 
-GLuint make_frag_prog( const GLchar *pcszShader )
+static void render_frame()
 {
-    GLuint hShader = glCreateShader( GL_FRAGMENT_SHADER );
-    if (!hShader) FAIL(( "Can't create shader!" ));
+    if (prof) prof->frame();
+    if (governing) governor->frame( iterations );
+    else governor->reset();
 
-    const GLchar *ppcszShader[1] = { pcszShader };
+    if (cpu) display_cpu();
+    else display_gl();
+    if (latency) latency->mark( LAT_draw );
+}
 
-    glShaderSource( hShader, 1, ppcszShader, NULL );
-    glCompileShader( hShader );
-    GLint nStatus;
-    glGetShaderiv( hShader, GL_COMPILE_STATUS, &nStatus );
-    if (!nStatus)
+//
+// display - handle GLUT repaints
+//
+
+void display()
+{
+    static float frame_time = 0;
+    static int n_frames = 0;
+    static unsigned long last_captured = 0, last_dropped = 0, last_reused = 0;
+    static double last_stall = 0;
+    frame_time += elapsed_ms();
+    ++n_frames;
+    if (frame_time > 1000)
     {
-    	char szBuff[10240];
-	glGetShaderInfoLog( hShader, sizeof(szBuff), NULL, szBuff );
-	FAIL(( "Shader failed to compile:\n%s", szBuff ));
+	unsigned long captured = capthread->captured();
+	unsigned long dropped = capthread->dropped();
+	unsigned long reused = capthread->reused();
+	double stall = upload ? upload->stall_ms() : 0;
+	char szBuff[320];
+	int len = sprintf( szBuff, "%s [%.2f fps, video %.2f fps, %s queue %lu dropped, %lu reused, upload stall %.2f ms", WINDOW_TITLE,
+	    1000.0f * n_frames / frame_time, 1000.0f * (captured - last_captured) / frame_time, queue_policy_name( capture_policy ),
+	    dropped - last_dropped, reused - last_reused, stall - last_stall );
+	if (governing)
+	{
+	    int w, h;
+	    render_size( w, h );
+	    len += sprintf( szBuff + len, ", holding %g fps at %dx%d, %d/%d iterations", target_fps, w, h, render_iterations(), iterations );
+	}
+	if (bailout) len += sprintf( szBuff + len, ", %.1f fetches/pixel", measure_fetches() );
+	if (deeping()) len += sprintf( szBuff + len, ", deep zoom %.3g", zoom );
+	if (progressive && !cpu) len += sprintf( szBuff + len, ", progressive" );
+	if (orbit_caching && !cpu) len += sprintf( szBuff + len, ", orbit cache" );
+	if (recorder) len += sprintf( szBuff + len, ", recording, %lu dropped", recorder->dropped() );
+	sprintf( szBuff + len, "]" );
+	glutSetWindowTitle( szBuff );
+	last_stall = stall;
+	frame_time = 0;
+	n_frames = 0;
+	last_captured = captured;
+	last_dropped = dropped;
+	last_reused = reused;
     }
-    //printf( "Shader compiled okay!\n" );
 
-    GLuint hProgram = glCreateProgram();
-    if (!hProgram) FAIL(( "Can\'t create program!" ));
+    render_frame();
+    if (recorder) record_frame();
 
-    glAttachShader( hProgram, hShader );
+    PROFILE_BEGIN(swap);
+    double swap_start = now_ms();
+    glutSwapBuffers();
+    if (governing) governor->idle( now_ms() - swap_start );
+    PROFILE_END(swap);
+    if (latency) latency->mark( LAT_submit );
+    glutPostRedisplay();
+}
 
-    glLinkProgram( hProgram );
-    glGetProgramiv( hProgram, GL_LINK_STATUS, &nStatus );
-    if (!nStatus)
+//
+// command - handle keyboard, menu or special key commands
+//
+
+void command( int cmd )
+{
+    switch (cmd)
+    {
+    #define MK_CMD_CASE(label,value,case,cmd) \
+    case cmd; break;
+    LIST_COMMANDS(MK_CMD_CASE)
+    }
+}
+
+//
+// keyboard - handle GLUT keypresses
+//
+
+void keyboard( unsigned char c, int x, int y )
+{
+    command( c );
+}
+
+//
+// special - handle other GLUT keypresses
+//
+
+void special( int c, int x, int y )
+{
+    command( MK_SPECIALKEY(c) );
+}
+
+//
+// set_julia_pos - map the window coordinates into the complex plane
+//
+
+static void set_julia_pos( int x, int y )
+{
+    int dx = x - julia_pt[0];
+    int dy = y - julia_pt[1];
+    // backwards, yech
+    jy = cx + (2 * zoom / scr_w) * dx;
+    jx = cy + (2 * zoom / scr_h) * dy * scr_aspect;
+    // it appears you can't update uniforms unless the appropriate
+    // program is being used...
+}
+
+//
+// motion - handle GLUT mouse motion
+//
+
+void motion( int x, int y )
+{
+    if (dragging)
+    {
+    	int dx = x - drag_pt[0];
+    	int dy = y - drag_pt[1];
+	cx -= (2 * zoom / scr_w) * dx;
+	cy -= (2 * zoom / scr_h) * dy * scr_aspect;
+    	drag_pt[0] = x;
+    	drag_pt[1] = y;
+    }
+
+    if (juliaing)
+    {
+	set_julia_pos( x, y );
+    }
+}
+
+//
+// mouse - handle GLUT mousing
+//
+
+void mouse( int button, int state, int x, int y )
+{
+    switch (button)
+    {
+    case GLUT_LEFT_BUTTON:
+    	dragging = (state == GLUT_DOWN);
+	drag_pt[0] = x;
+	drag_pt[1] = y;
+	break;
+
+    case GLUT_MIDDLE_BUTTON:
+	juliaing = (state == GLUT_DOWN);
+	// first point is at current center
+	julia_pt[0] = scr_w / 2;
+	julia_pt[1] = scr_h / 2;
+	set_julia_pos( x, y );
+    	break;
+
+    // GLUT_RIGHT_BUTTON used by menu!
+
+    case 3: // scollwheel
+    	if (state == GLUT_DOWN)
+	{
+	    zoom *= 0.9;
+	    clamp_zoom();
+	}
+	break;
+
+    case 4: // scrollwheel
+    	if (state == GLUT_DOWN)
+	{
+	    zoom *= 1.1;
+	    clamp_zoom();
+	}
+    	break;
+
+    default:
+    	if (verbose) fprintf( stderr, "%d %d (%d,%d)\n", button, state, x, y );
+	break;
+    }
+}
+
+//
+// init_zero_copy - give the capture device persistently mapped PBOs to capture into
+//
+
+static void init_zero_copy()
+{
+    zero_copy = false;
+    if (!vidcap || vidsrc != vidcap)
+    {
+	DBUG(( "Zero-copy needs a capture device delivering YUYV, copying video frames" ));
+	return;
+    }
+    if (!has_extension( "GL_ARB_buffer_storage" ))
+    {
+	DBUG(( "GL_ARB_buffer_storage unsupported, copying video frames" ));
+	return;
+    }
+
+    long page = sysconf( _SC_PAGESIZE );
+    size_t length = (vidsrc->bytesperframe() + page - 1) & ~(page - 1);
+    const GLbitfield access = GL_MAP_READ_BIT | GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+    zc_count = vidcap->buffercount();
+    zc_bufs = new GLuint[zc_count];
+    void **ptrs = new void *[zc_count];
+    glGenBuffers( zc_count, zc_bufs );
+    bool mapped = true;
+    for (int i = 0; i < zc_count; ++i)
     {
-    	char szBuff[10240];
-	glGetProgramInfoLog( hProgram, sizeof(szBuff), NULL, szBuff );
-	FAIL(( "Program failed to link:\n%s", szBuff ));
+	// client storage asks for system memory, which the capture driver can pin
+	glBindBuffer( GL_PIXEL_UNPACK_BUFFER, zc_bufs[i] );
+	glBufferStorage( GL_PIXEL_UNPACK_BUFFER, length, NULL, access | GL_CLIENT_STORAGE_BIT );
+	ptrs[i] = glMapBufferRange( GL_PIXEL_UNPACK_BUFFER, 0, length, access );
+	if (!ptrs[i]) mapped = false;
     }
-    //printf( "Program linked okay!\n" );
+    glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+    CHECK_GLERROR();
 
-    return( hProgram );
+    zero_copy = mapped && vidcap->map_userptr( ptrs, length, zc_count );
+    delete [] ptrs;
+    if (!zero_copy)
+    {
+	DBUG(( "Zero-copy capture unavailable, copying video frames" ));
+	glDeleteBuffers( zc_count, zc_bufs );
+	delete [] zc_bufs;
+	zc_bufs = NULL;
+	zc_count = 0;
+    }
+    else if (verbose) DBUG(( "Zero-copy capture into %d PBOs", zc_count ));
 }
 
 //
-// setviewport - setup viewport and projection
+// size_video_gl - (re)allocate the textures and upload buffers that are the size of the video
 //
 
-void setviewport( int w, int h )
+static void size_video_gl()
 {
-    glViewport( 0, 0, w, h );
-    glMatrixMode( GL_PROJECTION );
-    glLoadIdentity();
-    glOrtho( -1, 1, -1, 1, -1, 1 );
-}
+    glBindTexture( GL_TEXTURE_2D, yuv_tex );
+    glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA, vidsrc->width() / 2, vidsrc->height(), 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL );
+    CHECK_GLERROR();
 
-//
-// reshape - handle GLUT window resizing
-//
+    // setup pixel buffer objects (PBOs) to stream video data into, unless
+    // zero-copy capture can put it there directly
+    delete upload;
+    upload = NULL;
+    if (zero_copy) init_zero_copy();
+    if (!zero_copy) upload = new pbo_ring( vidsrc->bytesperframe(), upload_depth );
+
+    glBindTexture( rgb_target, rgb_tex );
+    if (GL_TEXTURE_2D_ARRAY == rgb_target)
+	glTexImage3D( GL_TEXTURE_2D_ARRAY, 0, GL_RGB, vidsrc->width(), vidsrc->height(), 1 + n_inputs, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL );
+    else glTexImage2D( GL_TEXTURE_2D, 0, GL_RGB, vidsrc->width(), vidsrc->height(), 0, GL_RGB, GL_UNSIGNED_BYTE, NULL );
+    CHECK_GLERROR();
 
-void reshape( int w, int h )
-{
-    scr_w = w;
-    scr_h = h;
-    scr_aspect = h / GLfloat(w);
-    setviewport( w, h );
+    vid_aspect = vidsrc->width() / GLfloat(vidsrc->height());
+
+    // and whichever is sampled needs its mip levels built again
+    mip_built = 0;
+    mip_frame_hash = 0;
 }
 
 //
-// display - handle GLUT repaints
+// init_gl - setup GL once the video capture device is initialized
 //
 
-void display()
+void init_gl()
 {
-    static float frame_time = 0;
-    static int n_frames = 0;
-    frame_time += elapsed_ms();
-    ++n_frames;
-    if (frame_time > 1000)
-    {
-	char szBuff[256];
-	sprintf( szBuff, "%s [%.2f fps]", WINDOW_TITLE, 1000.0f * n_frames / frame_time );
-	glutSetWindowTitle( szBuff );
-	frame_time = 0;
-	n_frames = 0;
-    }
+    double t0 = now_ms();
+    programs = new program_cache;
+    programs->init( program_dir );
 
-    // only fetch the video frame if we're using it
-    if (!showpoles)
+    if (use_aniso)
     {
-	//
-	// copy the video frame into the pbo (supposedly this saves a driver-side copy,
-	// but this is probably a wash since we end up doing the copy anyway)
-	//
+	glGetFloatv( GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &max_aniso );
+	if (verbose) fprintf( stderr, "MAX_ANISO: %f\n", max_aniso );
+	if (aniso_limit > 0 && aniso_limit < max_aniso) max_aniso = aniso_limit;
+	//glGenFramebuffersEXT( 1, &fb );
+    }
 
-	glBindBuffer( GL_PIXEL_UNPACK_BUFFER, yuv_buf );
-	void *pbo = glMapBuffer( GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY );
-	CHECK_GLERROR();
+    glActiveTexture( GL_TEXTURE0 );
+    glGenTextures( 1, &yuv_tex );
+    glBindTexture( GL_TEXTURE_2D, yuv_tex );
+    CHECK_GLERROR();
 
-	vidcap->wait();
-	int frameid = vidcap->get();
-	while (frameid >= 0)
-	{
-	    // skip frames if we're behind to reduce latency
-	    int nextframeid = vidcap->get();
-	    if (nextframeid < 0) memcpy( pbo, vidcap->data( frameid ), vidcap->bytesperframe() );
-	    vidcap->release( frameid );
-	    frameid = nextframeid;
-	}
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+    CHECK_GLERROR();
 
-	glUnmapBuffer( GL_PIXEL_UNPACK_BUFFER );
-	CHECK_GLERROR();
+    yuv_prog = programs->get(
+    	"uniform sampler2D yuv_tex;\n"
+	"uniform vec2 size;\n"
+	"uniform vec2 scale;\n"
+	"\n"
+	"void main( void )\n"
+	"{\n"
+	"   vec2 xy = floor( gl_TexCoord[0].xy * size );\n"
+	"   vec2 sp = (xy + vec2(0.5, 0.5)) * scale;\n"
+	"\n"
+	"   float y;\n"
+	"   if (fract( xy.x * 0.5 ) < 0.5)\n"
+	"   {\n"
+	"       y = texture2D( yuv_tex, vec2(sp.x + 0.5 * scale.x, sp.y) ).r;\n"
+	"   }\n"
+	"   else\n"
+	"   {\n"
+	"       y = texture2D( yuv_tex, vec2(sp.x - 0.5 * scale.x, sp.y) ).b;\n"
+	"   }\n"
+	"\n"
+	"   vec4 uv = texture2D( yuv_tex, sp );\n"
+	"   float u = uv.g - 0.5;\n"
+	"   float v = uv.a - 0.5;\n"
+	"   y = 1.1643 * (y - 0.0625);\n"
+	"   float r = y + 1.5958 * v;\n"
+	"   float g = y - 0.39173 * u - 0.81290 * v;\n"
+	"   float b = y + 2.017 * u;\n"
+	"   gl_FragColor.rgb = vec3(r, g, b);\n"
+	"}\n"
+    );
 
-	glBindTexture( GL_TEXTURE_2D, yuv_tex );
-	CHECK_GLERROR();
+    glUseProgram( yuv_prog->id );
+    glUniform1i( yuv_prog->loc[U_yuv_tex], 0 );
 
-	// define the texture using data at offset 0 in the PBO
-	// (note we could probably have this step running in another thread)
-	glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
-	glTexSubImage2D( GL_TEXTURE_2D, 0, 0, 0, vidcap->width() / 2, vidcap->height(), GL_RGBA, GL_UNSIGNED_BYTE, 0 );
-	CHECK_GLERROR();
+    // setup FBO and RGB texture
+    glGenFramebuffers( 1, &fb );
 
-	glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+    // with further inputs it's an array with a layer for each
+    if (n_inputs) rgb_target = GL_TEXTURE_2D_ARRAY;
+    glGenTextures( 1, &rgb_tex );
+    glBindTexture( rgb_target, rgb_tex );
+    CHECK_GLERROR();
 
-	//
-	// perform YUYV->RGB conversion into the RGB texture (via FBO)
-	//
+    glTexParameteri( rgb_target, GL_TEXTURE_MIN_FILTER, use_mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR );
+    glTexParameteri( rgb_target, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+    CHECK_GLERROR();
 
-	glBindFramebuffer( GL_FRAMEBUFFER, fb );
-	glBindTexture( GL_TEXTURE_2D, rgb_tex );
-	glFramebufferTexture2D( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, rgb_tex, 0 );
+    glTexParameteri( rgb_target, GL_TEXTURE_MAX_LEVEL, mip_max_level );
+    CHECK_GLERROR();
 
-	CheckFramebufferStatus();
+    if (use_aniso && max_aniso > 1) glTexParameterf( rgb_target, GL_TEXTURE_MAX_ANISOTROPY_EXT, max_aniso );
+    CHECK_GLERROR();
 
-	glViewport( 0, 0, vidcap->width(), vidcap->height() );
-	glMatrixMode( GL_PROJECTION );
-	glLoadIdentity();
-	glOrtho( 0, 1, 0, 1, 0, 1 );
+    size_video_gl();
 
-	glMatrixMode( GL_MODELVIEW );
-	glLoadIdentity();
+    for (int k = 0; k < n_inputs; ++k)
+    {
+	video_input &in = inputs[k];
+	glGenTextures( 1, &in.yuv_tex );
+	glBindTexture( GL_TEXTURE_2D, in.yuv_tex );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+	glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA, in.src->width() / 2, in.src->height(), 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL );
+	CHECK_GLERROR();
+	in.upload = new pbo_ring( in.src->bytesperframe(), upload_depth );
+    }
 
-	glUseProgram( yuv_prog );
+    // bailout breaks out of the loop, after which only explicit gradients are defined
+    bailout_grad = has_extension( "GL_ARB_shader_texture_lod" );
+    bailout_grad_array = bailout_grad && has_extension( "GL_EXT_gpu_shader4" );
+    if (!bailout_grad) DBUG(( "No GL_ARB_shader_texture_lod, bailout fetches every trip" ));
 
-	glBindTexture( GL_TEXTURE_2D, yuv_tex );
-	glTexEnvi( GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE );
-	glEnable( GL_TEXTURE_2D );
+    // the deep zoom reference orbit goes in a float texture
+    deep_gl = has_extension( "GL_ARB_texture_float" );
+    if (!deep_gl) DBUG(( "No GL_ARB_texture_float, deep zoom needs -c" ));
 
-	glBegin( GL_TRIANGLES );
-	    glTexCoord2f( -1,  1 ); glVertex2f( -1,  1 );
-	    glTexCoord2f(  1,  1 ); glVertex2f(  1,  1 );
-	    glTexCoord2f(  1, -1 ); glVertex2f(  1, -1 );
-	glEnd();
-	CHECK_GLERROR();
+    // and so does the orbit cache, built a few layers a pass with draw buffers
+    if (deep_gl)
+    {
+	GLint targets = 1;
+	glGetIntegerv( GL_MAX_DRAW_BUFFERS, &targets );
+	glGetIntegerv( GL_MAX_ARRAY_TEXTURE_LAYERS, &max_cache_layers );
+	cache_targets = (targets < max_cache_targets) ? targets : max_cache_targets;
     }
 
-    //
-    // render the RGB texture to the screen
-    //
-
-    glBindFramebufferEXT( GL_FRAMEBUFFER_EXT, 0 );
+    if (verbose) DBUG(( "%d programs compiled, %d loaded from %s, GL setup took %.1f ms",
+	programs->compiled(), programs->loaded(), program_dir ? program_dir : "nowhere", now_ms() - t0 ));
+}
 
-    reshape( scr_w, scr_h );
+//
+// capped_size - shrink a capture size to the smallest that still covers the output
+//
+// The fractal pass minifies the video everywhere but at its centre, so pixels
+// beyond the output resolution only cost bus bandwidth and upload time.
+//
 
-    glMatrixMode( GL_MODELVIEW );
-    glLoadIdentity();
+static void capped_size( int &w, int &h )
+{
+    double scale = fmax( scr_w / double(w), scr_h / double(h) );
+    if (!capture_capped || scale >= 1) return;
+    w = int(w * scale + 0.5);
+    h = int(h * scale + 0.5);
+}
 
-    GLuint prog =
-	juliaing ?
-	    (showpoles ? juliapole_prog : julia_prog)
-	    : (showpoles ? mandpole_prog : mand_prog);
+//
+// recapture - reconfigure the capture device for w x h without restarting
+//
+// Streaming stops and the device's buffers go back to the driver, so that it
+// can change format, then everything sized to the video is rebuilt and the
+// capture thread starts over on the new buffers.
+//
 
-    glUseProgram( prog );
-    if (juliaing) glUniform2f( glGetUniformLocation( prog, "c" ), jx, jy );
+static void recapture( int w, int h )
+{
+    if (!vidcap)
+    {
+	DBUG(( "Only capture devices can change size" ));
+	return;
+    }
+    capped_size( w, h );
+    if (w == vidcap->width() && h == vidcap->height())
+    {
+	DBUG(( "Already capturing at %dx%d%s", w, h, capture_capped ? " (capped at the output size, -S lifts that)" : "" ));
+	return;
+    }
 
-    if (animate_translation)
+    // the GPU must be done with the buffer it holds before the driver gets it back
+    if (zc_held >= 0)
     {
-	trans_scale += M_PI / 500.0f;
-	if (trans_scale >= 2 * M_PI) trans_scale -= 2 * M_PI;
+	glClientWaitSync( zc_fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED );
+	glDeleteSync( zc_fence );
+	release_frame( zc_held );
+	zc_held = -1;
     }
-    if (animate_translation_phase)
+    if (capthread) capthread->stop();
+    if (capturing) vidsrc->stop();
+    vidcap->free_buffers();
+    if (zc_bufs)
     {
-	trans_phase += M_PI / 500.0f;
-	if (trans_phase >= 2 * M_PI) trans_phase -= 2 * M_PI;
+	glDeleteBuffers( zc_count, zc_bufs );
+	delete [] zc_bufs;
+	zc_bufs = NULL;
+	zc_count = 0;
     }
-    float trans = 2.0f * cosf( trans_scale );
-    trans = trans * trans * trans;
-    // default to 1,1 (traditional mandlebrot)
-    float tpx = trans * cosf( trans_phase ) * M_SQRT2;
-    float tpy = trans * sinf( trans_phase ) * M_SQRT2;
-    glUniform2f( glGetUniformLocation( prog, "trans_scale" ), tpx, tpy );
-    if (animate_iters)
+    delete converter;
+    converter = NULL;
+
+    vidcap->init( w, h, capture_fps, capture_fourcc );
+    vidsrc = vidcap;
+    if (V4L2_PIX_FMT_YUYV != vidcap->pixelformat()) vidsrc = converter = new frame_converter( vidcap );
+    if (!cpu)
     {
-	iterations += iter_dir;
-	if (iterations >= iter_max)
-	{
-	    iterations = iter_max;
-	    iter_dir = -iter_dir;
-	}
-	else if (iterations <= 1)
-	{
-	    iterations = 1;
-	    iter_dir = -iter_dir;
-	}
+	size_video_gl();
+	rgb_stale = true;
     }
-    glUniform1f( glGetUniformLocation( prog, "iter_scale" ), 1.0f / iterations );
 
-    glBindTexture( GL_TEXTURE_2D, rgb_tex );
-    glTexEnvi( GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE );
-    if (mirror)
+    // otherwise main() starts it
+    if (capturing)
     {
-	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT );
-	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT );
+	if (!vidcap->userptr()) vidcap->map();
+	vidsrc->start();
     }
-    else
+    if (capthread)
     {
-	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT );
-	glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT );
+	capture_thread *ct = new capture_thread( vidsrc, capture_policy );
+	ct->continue_from( *capthread );
+	delete capthread;
+	capthread = ct;
+	capthread->start();
     }
-    glEnable( GL_TEXTURE_2D );
 
-    GLfloat left = cx - zoom;
-    GLfloat right = cx + zoom;
-    GLfloat top = cy - zoom * scr_aspect;
-    GLfloat bottom = cy + zoom * scr_aspect;
+    uint32_t f = vidcap->pixelformat();
+    DBUG(( "Capturing %.4s %dx%d at %.2f fps", (const char *)&f, vidcap->width(), vidcap->height(), vidcap->fps() ));
+}
 
-    glBegin( GL_TRIANGLES );
-	glTexCoord2f( left - (2 * zoom),  top );
-	glVertex2f( -3,  1 );
-	glTexCoord2f( right, top );
-	glVertex2f(  1,  1 );
-	glTexCoord2f( right, bottom + (2 * zoom) * scr_aspect );
-	glVertex2f(  1, -3 );
-    glEnd();
-    CHECK_GLERROR();
+//
+// recapture_step - capture at the next size the device offers up (dir > 0) or down
+//
 
-    glutSwapBuffers();
-    glutPostRedisplay();
+static void recapture_step( int dir )
+{
+    int w, h;
+    if (!vidcap) DBUG(( "Only capture devices can change size" ));
+    else if (!vidcap->step_size( dir, w, h )) DBUG(( "No %s capture size", (dir > 0) ? "larger" : "smaller" ));
+    else recapture( w, h );
 }
 
 //
-// command - handle keyboard, menu or special key commands
+// open_source - open a raw video file (- for stdin) or, if file is NULL,
+// /dev/video<dev>, and put a converter in front of it unless it's YUYV
 //
 
-void command( int cmd )
+static frame_source *open_source( const char *file, int dev, int w, int h, double fps, uint32_t fourcc, vid_capture *&cap, frame_converter *&conv )
 {
-    switch (cmd)
+    frame_source *src;
+    cap = NULL;
+    if (file)
     {
-    #define MK_CMD_CASE(label,value,case,cmd) \
-    case cmd; break;
-    LIST_COMMANDS(MK_CMD_CASE)
+	file_source *fs = new file_source( capture_buffers );
+	fs->open( file, w, h, fourcc ? fourcc : V4L2_PIX_FMT_YUYV, fps );
+	src = fs;
     }
+    else
+    {
+	capped_size( w, h );
+	cap = new vid_capture( capture_buffers );
+	cap->open( dev );
+	cap->init( w, h, fps, fourcc );
+	src = cap;
+    }
+    conv = NULL;
+    if (V4L2_PIX_FMT_YUYV != src->pixelformat()) src = conv = new frame_converter( src );
+    return( src );
 }
 
 //
-// keyboard - handle GLUT keypresses
+// init_egl - create an offscreen GL context, surfaceless if the platform allows it
 //
 
-void keyboard( unsigned char c, int x, int y )
+static void init_egl()
 {
-    command( c );
+    EGLDisplay dpy = EGL_NO_DISPLAY;
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+	(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress( "eglGetPlatformDisplayEXT" );
+    if (get_platform_display) dpy = get_platform_display( EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL );
+    if (EGL_NO_DISPLAY == dpy) dpy = eglGetDisplay( EGL_DEFAULT_DISPLAY );
+
+    EGLint major, minor;
+    if (EGL_NO_DISPLAY == dpy || !eglInitialize( dpy, &major, &minor )) FAIL(( "Can't initialize EGL" ));
+    if (!eglBindAPI( EGL_OPENGL_API )) FAIL(( "EGL has no desktop GL" ));
+
+    static const EGLint config_attribs[] =
+    {
+	EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+	EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+	EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+	EGL_NONE
+    };
+    EGLConfig config;
+    EGLint n_configs = 0;
+    if (!eglChooseConfig( dpy, config_attribs, &config, 1, &n_configs ) || n_configs < 1) FAIL(( "No EGL pbuffer config" ));
+
+    EGLContext ctx = eglCreateContext( dpy, config, EGL_NO_CONTEXT, NULL );
+    if (EGL_NO_CONTEXT == ctx) FAIL(( "Can't create EGL context (0x%x)", eglGetError() ));
+
+    // everything renders to FBOs, so a tiny pbuffer does if surfaceless isn't available
+    EGLSurface surf = EGL_NO_SURFACE;
+    if (!strstr( eglQueryString( dpy, EGL_EXTENSIONS ), "EGL_KHR_surfaceless_context" ))
+    {
+	static const EGLint pbuffer_attribs[] = { EGL_WIDTH, 16, EGL_HEIGHT, 16, EGL_NONE };
+	surf = eglCreatePbufferSurface( dpy, config, pbuffer_attribs );
+    }
+    if (!eglMakeCurrent( dpy, surf, surf, ctx )) FAIL(( "Can't make EGL context current (0x%x)", eglGetError() ));
+    if (verbose) DBUG(( "EGL %d.%d: %s", major, minor, glGetString( GL_RENDERER ) ));
 }
 
 //
-// special - handle other GLUT keypresses
+// init_screen_fb - offscreen FBO standing in for the window when headless
 //
 
-void special( int c, int x, int y )
+static void init_screen_fb()
 {
-    command( MK_SPECIALKEY(c) );
+    glGenTextures( 1, &screen_tex );
+    glBindTexture( GL_TEXTURE_2D, screen_tex );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+    glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA8, scr_w, scr_h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL );
+    glGenFramebuffers( 1, &screen_fb );
+    glBindFramebuffer( GL_FRAMEBUFFER, screen_fb );
+    glFramebufferTexture2D( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, screen_tex, 0 );
+    CheckFramebufferStatus();
+    CHECK_GLERROR();
 }
 
 //
-// set_julia_pos - map the window coordinates into the complex plane
+// write_frame - write a bottom-up RGBA image as top-down RGB, either raw or as a PPM
 //
 
-static void set_julia_pos( int x, int y )
+static void write_frame( FILE *fp, const uint32_t *rgba, int w, int h, bool ppm )
 {
-    int dx = x - julia_pt[0];
-    int dy = y - julia_pt[1];
-    // backwards, yech
-    jy = cx + (2 * zoom / scr_w) * dx;
-    jx = cy + (2 * zoom / scr_h) * dy * scr_aspect;
-    // it appears you can't update uniforms unless the appropriate
-    // program is being used...
+    static unsigned char *row = NULL;
+    static int row_w = 0;
+    if (row_w < w)
+    {
+	delete [] row;
+	row = new unsigned char[w * 3];
+	row_w = w;
+    }
+
+    if (ppm) fprintf( fp, "P6\n%d %d\n255\n", w, h );
+    for (int y = h - 1; y >= 0; --y)
+    {
+	const uint32_t *src = rgba + y * w;
+	for (int x = 0; x < w; ++x)
+	{
+	    row[3 * x + 0] = src[x];
+	    row[3 * x + 1] = src[x] >> 8;
+	    row[3 * x + 2] = src[x] >> 16;
+	}
+	if (1 != fwrite( row, w * 3, 1, fp )) FAIL(( "Error writing frame (%s)", strerror( errno ) ));
+    }
 }
 
 //
-// motion - handle GLUT mouse motion
+// start_recording - stream every frame to output, - for stdout, through a frame_recorder
+//
+// The format is -O's, or Y4M for names ending in .y4m and raw RGB otherwise.
+// Frames are at the window or -g size and are dropped while the window is
+// resized away from it.  A video device (e.g. v4l2loopback's, or vivid's
+// output) is fed through a vid_output instead, as YUYV unless -O says
+// otherwise, since that is what most readers of a camera expect.
 //
 
-void motion( int x, int y )
+static void start_recording( const char *output, bool lossless )
 {
-    if (dragging)
+    struct stat st;
+    // video4linux's major, so that /dev/null is still a file
+    bool device = strcmp( output, "-" ) && 0 == stat( output, &st ) && S_ISCHR( st.st_mode ) && 81 == major( st.st_rdev );
+    record_format format = record_fmt;
+    if (N_RECORD_FORMATS == format)
     {
-    	int dx = x - drag_pt[0];
-    	int dy = y - drag_pt[1];
-	cx -= (2 * zoom / scr_w) * dx;
-	cy -= (2 * zoom / scr_h) * dy * scr_aspect;
-    	drag_pt[0] = x;
-    	drag_pt[1] = y;
+	const char *ext = strrchr( output, '.' );
+	format = device ? RECORD_yuyv : (ext && !strcasecmp( ext, ".y4m" )) ? RECORD_y4m : RECORD_rgb;
     }
 
-    if (juliaing)
+    if (device)
     {
-	set_julia_pos( x, y );
+	if (RECORD_y4m == format) FAIL(( "%s is a device, y4m can only go to a file", output ));
+	uint32_t fourcc = (RECORD_yuyv == format) ? V4L2_PIX_FMT_YUYV : (RECORD_nv12 == format) ? V4L2_PIX_FMT_NV12 : V4L2_PIX_FMT_RGB24;
+	record_dev = new vid_output();
+	record_dev->open( output );
+	record_dev->init( scr_w, scr_h, fourcc, capture_fps );
+	record_dev->map();
+	record_dev->start();
+    }
+    else
+    {
+	record_fp = strcmp( output, "-" ) ? fopen( output, "wb" ) : stdout;
+	if (!record_fp) FAIL(( "Can't create %s", output ));
+    }
+    recorder = new frame_recorder( record_fp, record_dev, format, scr_w, scr_h, capture_fps, lossless, !cpu || !headless );
+}
+
+//
+// record_frame - start the readback of the frame in screen_fb, converted to YUV first if the recorder takes that
+//
+
+static void record_frame()
+{
+    if (recorder->yuv() && scr_w == recorder->width() && scr_h == recorder->height())
+    {
+	GLuint tex = screen_tex;
+	if (!screen_fb)
+	{
+	    // the window's back buffer has no texture to sample
+	    if (!output_copy_tex)
+	    {
+		glGenTextures( 1, &output_copy_tex );
+		glBindTexture( GL_TEXTURE_2D, output_copy_tex );
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+		glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+		glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA8, scr_w, scr_h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL );
+	    }
+	    glBindFramebuffer( GL_FRAMEBUFFER, 0 );
+	    glBindTexture( GL_TEXTURE_2D, output_copy_tex );
+	    glCopyTexSubImage2D( GL_TEXTURE_2D, 0, 0, 0, 0, 0, scr_w, scr_h );
+	    tex = output_copy_tex;
+	}
+	convert_output( tex, scr_w, scr_h, recorder->nv12() );
+    }
+    else glBindFramebuffer( GL_FRAMEBUFFER, screen_fb );
+
+    PROFILE_BEGIN(readback);
+    recorder->capture( scr_w, scr_h );
+    PROFILE_END(readback);
+    glBindFramebuffer( GL_FRAMEBUFFER, screen_fb );
+}
+
+//
+// stop_recording - write out the frames in flight, report and close the output
+//
+
+static void stop_recording()
+{
+    if (!recorder) return;
+    // the window (and its context) may already be gone when GLUT exits
+    recorder->stop( headless || glutGetWindow() );
+    recorder->report( stderr );
+    delete recorder;
+    recorder = NULL;
+    if (record_dev)
+    {
+	record_dev->stop();
+	delete record_dev;
+	record_dev = NULL;
     }
+    if (record_fp && record_fp != stdout) fclose( record_fp );
+    record_fp = NULL;
 }
 
 //
-// mouse - handle GLUT mousing
+// run_headless - render n_frames offscreen and write them to output
+//
+// output is "-" for raw RGB (or -O y4m) on stdout, a printf pattern (e.g.
+// "out%05d.ppm") for a numbered PPM sequence, or any other name for a file
+// as for start_recording().
 //
 
-void mouse( int button, int state, int x, int y )
+static void run_headless( int n_frames, const char *output )
 {
-    switch (button)
-    {
-    case GLUT_LEFT_BUTTON:
-    	dragging = (state == GLUT_DOWN);
-	drag_pt[0] = x;
-	drag_pt[1] = y;
-	break;
-
-    case GLUT_MIDDLE_BUTTON:
-	juliaing = (state == GLUT_DOWN);
-	// first point is at current center
-	julia_pt[0] = scr_w / 2;
-	julia_pt[1] = scr_h / 2;
-	set_julia_pos( x, y );
-    	break;
-
-    // GLUT_RIGHT_BUTTON used by menu!
+    bool sequence = output && strchr( output, '%' );
+    // headless frames wait for the writer rather than being dropped
+    if (output && !sequence) start_recording( output, true );
 
-    case 3: // scollwheel
-    	if (state == GLUT_DOWN)
+    uint32_t *pixels = (cpu || !sequence) ? NULL : new uint32_t[scr_w * scr_h];
+    double t0 = now_ms();
+    for (int i = 0; i < n_frames; ++i)
+    {
+	render_frame();
+	if (!output)
 	{
-	    zoom *= 0.9;
-	    if (zoom < 1e-9) zoom = 1e-9;
+	    if (latency) latency->mark( LAT_submit );
+	    continue;
 	}
-	break;
 
-    case 4: // scrollwheel
-    	if (state == GLUT_DOWN)
+	const uint32_t *rgba = pixels;
+	if (cpu) rgba = cpu->pixels();
+	else if (recorder) record_frame();
+	else
 	{
-	    zoom *= 1.1;
-	    if (zoom > 1e+3) zoom = 1e+3;
+	    PROFILE_BEGIN(readback);
+	    glBindFramebuffer( GL_FRAMEBUFFER, screen_fb );
+	    glPixelStorei( GL_PACK_ALIGNMENT, 4 );
+	    glReadPixels( 0, 0, scr_w, scr_h, GL_RGBA, GL_UNSIGNED_BYTE, pixels );
+	    CHECK_GLERROR();
+	    PROFILE_END(readback);
 	}
-    	break;
+	// a readback is as far as a headless frame goes
+	if (latency) latency->mark( LAT_submit );
 
-    default:
-    	if (verbose) fprintf( stderr, "%d %d (%d,%d)\n", button, state, x, y );
-	break;
+	if (sequence)
+	{
+	    char name[PATH_MAX];
+	    snprintf( name, sizeof(name), output, i );
+	    FILE *fp = fopen( name, "wb" );
+	    if (!fp) FAIL(( "Can't create %s", name ));
+	    write_frame( fp, rgba, scr_w, scr_h, true );
+	    fclose( fp );
+	}
+	else if (cpu) recorder->add( rgba );
     }
+    stop_recording();
+    if (!cpu) glFinish();
+    double ms = now_ms() - t0;
+
+    delete [] pixels;
+    DBUG(( "%d %dx%d frames in %.3f s (%.2f fps, %s, %.2f fetches/pixel)", n_frames, scr_w, scr_h, ms * 1e-3, n_frames * 1e3 / ms,
+	cpu ? "cpu" : (const char *)glGetString( GL_RENDERER ), n_frames ? measure_fetches() : 0 ));
 }
 
 //
-// init_gl - setup GL once the video capture device is started
+// run_bench - render a fixed set of scenarios and print a CSV line for each
+//
+// Each scenario resets the view, so results only depend on the input, the
+// output size and the backend.  Frames are rendered back to back as in
+// run_headless (upload, YUV->RGB and fractal passes, no readback) after a
+// couple of warm-up frames.
 //
 
-void init_gl()
+static void run_bench( int n_frames, const char *source )
 {
-    if (use_aniso)
+    // iteration presets from LIST_COMMANDS
+    static const struct { char key; int iterations; } iters[] = { { '1', 1 }, { '8', 8 }, { '9', 16 }, { '0', 100 } };
+    static const char *variants[] = { "plain", "mirror", "poles", "bailout", "direct", "cached" };
+    // the 'r' zoom, then in on a point near the boundary of the set
+    static const GLfloat zooms[] = { 1.5f, 0.15f, 0.015f };
+    static const int WARMUP_FRAMES = 2;
+
+    char renderer[256];
+    if (cpu) snprintf( renderer, sizeof(renderer), "%s x%d", cpu->isa(), cpu->threads() );
+    else snprintf( renderer, sizeof(renderer), "%s", (const char *)glGetString( GL_RENDERER ) );
+    // keep the CSV trivially splittable
+    for (char *c = renderer; *c; ++c) if (',' == *c || '"' == *c) *c = ';';
+    printf( "backend,renderer,source,scenario,fractal,iterations,mirror,poles,zoom,aniso,width,height,frames,ms_per_frame,fps,ns_per_pixel,bailout,fetches_per_pixel,yuv_path\n" );
+    for (int z = 0; z < 3; ++z)
+    for (int f = 0; f < 2; ++f)
+    for (int v = 0; v < 6; ++v)
+    for (int n = 0; n < 4; ++n)
     {
-	glGetFloatv( GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &max_aniso );
-	if (verbose) fprintf( stderr, "MAX_ANISO: %f\n", max_aniso );
-	//glGenFramebuffersEXT( 1, &fb );
+	// the full matrix at the reset zoom, plain and orbit cached renders of
+	// it zoomed in, and the single pass YUYV path and the orbit cache only
+	// on GL.  The warm-up frames build the cache
+	if (z && v && 5 != v) continue;
+	if (v >= 4 && cpu) continue;
+
+	command( 'r' );
+	command( 'm' );
+	command( 'T' );
+	command( iters[n].key );
+	if (z)
+	{
+	    cx = 0.1f;
+	    cy = -0.7f;
+	}
+	zoom = zooms[z];
+	animate_translation = animate_translation_phase = animate_iters = governing = false;
+	mirror = (1 == v);
+	showpoles = (2 == v);
+	bailout = (3 == v);
+	yuv_direct = (4 == v);
+	orbit_caching = (5 == v);
+	juliaing = (1 == f);
+	jx = -0.4f;
+	jy = 0.6f;
+
+	char scenario[64];
+	snprintf( scenario, sizeof(scenario), "%s-i%d-%s-z%g", juliaing ? "julia" : "mand", iterations, variants[v], zoom );
+
+	double t0 = 0;
+	for (int i = -WARMUP_FRAMES; i < n_frames; ++i)
+	{
+	    if (!i)
+	    {
+		if (!cpu) glFinish();
+		t0 = now_ms();
+	    }
+	    render_frame();
+	}
+	if (!cpu) glFinish();
+	double ms = (now_ms() - t0) / n_frames;
+
+	printf( "%s,%s,%s,%s,%s,%d,%d,%d,%g,%g,%d,%d,%d,%.3f,%.2f,%.3f,%g,%.2f,%s\n",
+	    cpu ? "cpu" : "gl", renderer, source, scenario, juliaing ? "julia" : "mandelbrot", iterations, mirror, showpoles, zoom,
+	    cpu ? 0 : max_aniso, scr_w, scr_h, n_frames, ms, 1000.0 / ms, ms * 1.0e6 / (scr_w * scr_h),
+	    bailout ? bailout_radius : 0, measure_fetches(), cpu ? "cpu" : yuv_direct ? "direct" : "2pass" );
+	fflush( stdout );
     }
+}
 
-    glActiveTexture( GL_TEXTURE0 );
-    glGenTextures( 1, &yuv_tex );
-    glBindTexture( GL_TEXTURE_2D, yuv_tex );
-    CHECK_GLERROR();
-
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
-    CHECK_GLERROR();
-
-    glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA, vidcap->width() / 2, vidcap->height(), 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL );
+//
+// check_output - round trip a video frame through yuv_prog and convert_output() and report the error
+//
+// A -s sized YUYV frame of smooth colour ramps goes through yuv_prog into
+// rgb_tex as video would, and is packed back into YUYV and NV12, which should
+// give back the bytes it started as up to rounding (for NV12, with the chroma
+// of each pair of rows averaged), and that YUYV goes through yuv_prog again to
+// compare with the first RGB.  The ramps stay inside the RGB gamut and keep
+// the chroma linear across each row, where yuv_prog's interpolation and the
+// averaging undo each other; camera video has neither (the test card's bars
+// are far out of gamut), and would only show the clamping and subsampling.
+//
 
-    yuv_prog = make_frag_prog(
-    	"uniform sampler2D yuv_tex;\n"
-	"uniform vec2 size;\n"
-	"uniform vec2 scale;\n"
-	"\n"
-	"void main( void )\n"
-	"{\n"
-	"   vec2 xy = floor( gl_TexCoord[0].xy * size );\n"
-	"   vec2 sp = (xy + vec2(0.5, 0.5)) * scale;\n"
-	"\n"
-	"   float y;\n"
-	"   if (fract( xy.x * 0.5 ) < 0.5)\n"
-	"   {\n"
-	"       y = texture2D( yuv_tex, vec2(sp.x + 0.5 * scale.x, sp.y) ).r;\n"
-	"   }\n"
-	"   else\n"
-	"   {\n"
-	"       y = texture2D( yuv_tex, vec2(sp.x - 0.5 * scale.x, sp.y) ).b;\n"
-	"   }\n"
-	"\n"
-	"   vec4 uv = texture2D( yuv_tex, sp );\n"
-	"   float u = uv.g - 0.5;\n"
-	"   float v = uv.a - 0.5;\n"
-	"   y = 1.1643 * (y - 0.0625);\n"
-	"   float r = y + 1.5958 * v;\n"
-	"   float g = y - 0.39173 * u - 0.81290 * v;\n"
-	"   float b = y + 2.017 * u;\n"
-	"   gl_FragColor.rgb = vec3(r, g, b);\n"
-	"}\n"
-    );
+struct byte_error
+{
+    int		max;
+    double	mean;
+    double	over;				// fraction off by more than 1
+};
 
-    glUseProgram( yuv_prog );
-    glUniform1i( glGetUniformLocation( yuv_prog, "yuv_tex" ), 0 );
-    glUniform2f( glGetUniformLocation( yuv_prog, "size" ), GLfloat(vidcap->width()), GLfloat(vidcap->height()) );
-    glUniform2f( glGetUniformLocation( yuv_prog, "scale" ), 1.0 / GLfloat(vidcap->width()), 1.0 / GLfloat(vidcap->height()) );
+// compare_bytes - the bytes of a and b at positions in each period whose bit is set in mask
+static byte_error compare_bytes( const unsigned char *a, const unsigned char *b, size_t n, int period, unsigned mask )
+{
+    byte_error e = { 0, 0, 0 };
+    size_t count = 0, over = 0;
+    double sum = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+	if (!(mask & (1 << (i % period)))) continue;
+	int d = abs( a[i] - b[i] );
+	if (d > e.max) e.max = d;
+	sum += d;
+	over += (d > 1);
+	++count;
+    }
+    e.mean = count ? sum / count : 0;
+    e.over = count ? double(over) / count : 0;
+    return( e );
+}
 
-    // setup a pixel buffer object (PBO) to stream video data into
-    glGenBuffers( 1, &yuv_buf );
-    glBindBuffer( GL_PIXEL_UNPACK_BUFFER, yuv_buf );
-    glBufferData( GL_PIXEL_UNPACK_BUFFER, vidcap->bytesperframe(), NULL, GL_STREAM_DRAW );
-    glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
-    
-    // setup FBO and RGB texture
-    glGenFramebuffers( 1, &fb );
+static bool check_output()
+{
+    // set rgb_tex up as for rendering
+    render_frame();
+    int w = vidsrc->width(), h = vidsrc->height();
+    if (w % 4 || h % 2) FAIL(( "-T needs a frame a multiple of 4 wide and 2 high" ));
+    size_t n = size_t(w) * h;
+    unsigned char *yuyv = new unsigned char[n * 2];
+    unsigned char *back = new unsigned char[n * 2];
+    unsigned char *expect = new unsigned char[n * 3 / 2];
+    unsigned char *nv12 = new unsigned char[n * 3 / 2];
+    unsigned char *rgb = new unsigned char[n * 4];
+    unsigned char *rgb2 = new unsigned char[n * 4];
+
+    for (int y = 0; y < h; ++y)
+	for (int x = 0; x < w; x += 2)
+	{
+	    unsigned char *p = yuyv + (y * w + x) * 2;
+	    double u = 0, v = 0;
+	    for (int k = 0; k < 2; ++k)
+	    {
+		double r = 0.1 + 0.8 * (x + k) / w, g = 0.1 + 0.8 * y / h, b = 0.9 - 0.6 * (x + k) / w;
+		p[2 * k] = (unsigned char)(255 * (0.256816 * r + 0.504155 * g + 0.097914 * b + 0.0625) + 0.5);
+		u += 0.5 * (-0.148246 * r - 0.291020 * g + 0.439266 * b + 0.5);
+		v += 0.5 * (0.439271 * r - 0.367833 * g - 0.071438 * b + 0.5);
+	    }
+	    p[1] = (unsigned char)(255 * u + 0.5);
+	    p[3] = (unsigned char)(255 * v + 0.5);
+	}
 
-    glGenTextures( 1, &rgb_tex );
+    glBindTexture( GL_TEXTURE_2D, yuv_tex );
+    glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+    glTexSubImage2D( GL_TEXTURE_2D, 0, 0, 0, w / 2, h, GL_RGBA, GL_UNSIGNED_BYTE, yuyv );
+    convert_yuv( yuv_tex, w, h, 0 );
+    glPixelStorei( GL_PACK_ALIGNMENT, 4 );
     glBindTexture( GL_TEXTURE_2D, rgb_tex );
-    CHECK_GLERROR();
+    glGetTexImage( GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, rgb );
 
+    // rgb_tex is top down already, and sampled the way convert_output() wants
+    // for the two passes, then put back for the fractal pass
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+    if (use_aniso && max_aniso > 1) glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, 1 );
+    convert_output( rgb_tex, w, h, false, false );
+    glReadPixels( 0, 0, w / 2, h, GL_RGBA, GL_UNSIGNED_BYTE, back );
+    convert_output( rgb_tex, w, h, true, false );
+    glReadPixels( 0, 0, w / 4, h + h / 2, GL_RGBA, GL_UNSIGNED_BYTE, nv12 );
+    glBindTexture( GL_TEXTURE_2D, rgb_tex );
     glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, use_mipmaps ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR );
     glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
-    CHECK_GLERROR();
-
-    if (use_mipmaps) glTexParameteri( GL_TEXTURE_2D, GL_GENERATE_MIPMAP_SGIS, GL_TRUE );
-    CHECK_GLERROR();
+    if (use_aniso && max_aniso > 1) glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, max_aniso );
+    video_wrap = -1;
 
-    if (use_aniso) glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY_EXT, max_aniso );
+    glBindTexture( GL_TEXTURE_2D, yuv_tex );
+    glTexSubImage2D( GL_TEXTURE_2D, 0, 0, 0, w / 2, h, GL_RGBA, GL_UNSIGNED_BYTE, back );
+    convert_yuv( yuv_tex, w, h, 0 );
+    glBindTexture( GL_TEXTURE_2D, rgb_tex );
+    glGetTexImage( GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, rgb2 );
+    glBindFramebuffer( GL_FRAMEBUFFER, screen_fb );
     CHECK_GLERROR();
 
-    glTexImage2D( GL_TEXTURE_2D, 0, GL_RGB, vidcap->width(), vidcap->height(), 0, GL_RGB, GL_UNSIGNED_BYTE, NULL );
-
-    vid_aspect = vidcap->width() / GLfloat(vidcap->height());
-
-    mand_prog = make_frag_prog(
-    	"uniform sampler2D rgb_tex;\n"
-	"uniform vec2 trans_scale;\n"
-	"uniform float vid_aspect;\n"
-	"uniform float iter_scale;\n"
-	"\n"
-	"void main( void )\n"
-	"{\n"
-    	"   vec2 p = gl_TexCoord[0].yx;\n"
-    	"   vec2 c = trans_scale * p;\n"
-	"   float s = 0;\n"
-	"   vec3 rgb = 0.0;\n"
-	"\n"
-	"   while (s < 1.0)\n"
-	"   {\n"
-	"       p = vec2( p.x * p.x - p.y * p.y + c.x, 2.0 * p.x * p.y + c.y );\n"
-	"   	rgb += texture2D( rgb_tex, vec2(p.y + 0.5, (p.x * vid_aspect) + 0.5) );\n"
-	"   	s += iter_scale;\n"
-	"   }\n"
-	"\n"
-	"   //gl_FragColor.rgb = texture2D( rgb_tex, vec2(p.y + 0.5, (p.x * vid_aspect) + 0.5) );\n"
-	"   gl_FragColor.rgb = rgb * iter_scale;\n"
-	"}\n"
-    );
-
-    glUseProgram( mand_prog );
-    glUniform1i( glGetUniformLocation( mand_prog, "rgb_tex" ), 0 );
-    glUniform1f( glGetUniformLocation( mand_prog, "vid_aspect" ), vid_aspect );
-
-    mandpole_prog = make_frag_prog(
-	"uniform vec2 trans_scale;\n"
-	"uniform float iter_scale;\n"
-	"\n"
-	"void main( void )\n"
-	"{\n"
-    	"   vec2 p = gl_TexCoord[0].yx;\n"
-    	"   vec2 c = trans_scale * p;\n"
-	"   float s = 0;\n"
-	"\n"
-	"   while (s < 1.0)\n"
-	"   {\n"
-	"       p = vec2( p.x * p.x - p.y * p.y + c.x, 2.0 * p.x * p.y + c.y );\n"
-	"   	s += iter_scale;\n"
-	"   }\n"
-	"\n"
-	"   float len = length(p);\n"
-	"   float r = (len > 0) ? (1 / len) : 0;\n"
-	"   p *= r;\n"
-	"   gl_FragColor.rg = 0.5 * (p + 1);\n"
-	"   gl_FragColor.b = (r < 1) ? r : len;\n"
-	"}\n"
-    );
+    // the NV12 the original YUYV would make
+    unsigned char *uv = expect + n;
+    for (size_t i = 0; i < n; ++i) expect[i] = yuyv[2 * i];
+    for (int y = 0; y < h; y += 2)
+	for (int x = 0; x < w; ++x)
+	    uv[(y / 2) * w + x] = (yuyv[(y * w + x) * 2 + 1] + yuyv[((y + 1) * w + x) * 2 + 1] + 1) / 2;
+
+    static const char *names[] = { "YUYV Y", "YUYV UV", "NV12 Y", "NV12 UV", "RGB" };
+    byte_error e[5];
+    e[0] = compare_bytes( yuyv, back, n * 2, 2, 1 );
+    e[1] = compare_bytes( yuyv, back, n * 2, 2, 2 );
+    e[2] = compare_bytes( expect, nv12, n, 1, 1 );
+    e[3] = compare_bytes( uv, nv12 + n, n / 2, 1, 1 );
+    e[4] = compare_bytes( rgb, rgb2, n * 4, 4, 7 );
+    bool ok = true;
+    msg( "%dx%d frame through yuv_prog and back:", w, h );
+    for (int i = 0; i < 5; ++i)
+    {
+	bool pass = e[i].mean < 0.5 && e[i].over < 0.01;
+	msg( "%-8s max %3d, mean %.3f, %.3f%% off by more than 1%s", names[i], e[i].max, e[i].mean, 100 * e[i].over, pass ? "" : "  FAIL" );
+	ok &= pass;
+    }
 
-    julia_prog = make_frag_prog(
-    	"uniform sampler2D rgb_tex;\n"
-	"uniform vec2 trans_scale;\n"
-	"uniform float vid_aspect;\n"
-	"uniform float iter_scale;\n"
-    	"uniform vec2 c;\n"
-	"\n"
-	"void main( void )\n"
-	"{\n"
-    	"   vec2 p = gl_TexCoord[0].yx;\n"
-    	"   vec2 cc = trans_scale * c;\n"
-	"   float s = 0;\n"
-	"   vec3 rgb = 0.0;\n"
-	"\n"
-	"   while (s < 1.0)\n"
-	"   {\n"
-	"       p = vec2( p.x * p.x - p.y * p.y + cc.x, 2.0 * p.x * p.y + cc.y );\n"
-	"       //p = vec2( p.x * cc.x - p.y * cc.y + p.x, 2.0 * p.x * cc.y + p.y );\n"
-	"   	rgb += texture2D( rgb_tex, vec2(p.y + 0.5, (p.x * vid_aspect) + 0.5) );\n"
-	"   	s += iter_scale;\n"
-	"   }\n"
-	"\n"
-	"   gl_FragColor.rgb = rgb * iter_scale;\n"
-	"}\n"
-    );
+    delete [] rgb2;
+    delete [] rgb;
+    delete [] nv12;
+    delete [] expect;
+    delete [] back;
+    delete [] yuyv;
+    return( ok );
+}
 
-    glUseProgram( julia_prog );
-    glUniform1i( glGetUniformLocation( julia_prog, "rgb_tex" ), 0 );
-    glUniform1f( glGetUniformLocation( julia_prog, "vid_aspect" ), vid_aspect );
+//
+// report_profile - print and dump the profile at exit
+//
 
-    juliapole_prog = make_frag_prog(
-	"uniform vec2 trans_scale;\n"
-	"uniform float iter_scale;\n"
-    	"uniform vec2 c;\n"
-	"\n"
-	"void main( void )\n"
-	"{\n"
-    	"   vec2 p = gl_TexCoord[0].yx;\n"
-    	"   vec2 cc = trans_scale * c;\n"
-	"   float s = 0;\n"
-	"\n"
-	"   while (s < 1.0)\n"
-	"   {\n"
-	"       p = vec2( p.x * p.x - p.y * p.y + cc.x, 2.0 * p.x * p.y + cc.y );\n"
-	"       //p = vec2( p.x * cc.x - p.y * cc.y + p.x, 2.0 * p.x * cc.y + p.y );\n"
-	"   	s += iter_scale;\n"
-	"   }\n"
-	"\n"
-	"   float len = length(p);\n"
-	"   float r = (len > 0) ? (1 / len) : 0;\n"
-	"   p *= r;\n"
-	"   gl_FragColor.rg = 0.5 * (p + 1);\n"
-	"   gl_FragColor.b = (r < 1) ? r : len;\n"
-	"}\n"
-    );
+static void report_profile()
+{
+    if (!prof) return;
+    // the window (and its context) may already be gone when GLUT exits
+    if (headless || glutGetWindow()) prof->finish();
+    prof->report( stderr );
+    if (capthread) capthread->report( stderr );
+    double total = capthread ? capthread->capture_fps() : 0;
+    for (int k = 0; k < n_inputs; ++k)
+    {
+	fprintf( stderr, "input %d: ", 1 + k );
+	inputs[k].thread->report( stderr );
+	total += inputs[k].thread->capture_fps();
+    }
+    if (n_inputs) fprintf( stderr, "%d inputs: %.2f fps captured in all\n", 1 + n_inputs, total );
+    if (latency) latency->report( stderr, capthread ? capthread->captured() : 0, capthread ? capthread->dropped() : 0 );
+    prof->dump( prof_file );
+    DBUG(( "profile written to %s", prof_file ));
+    delete prof;
+    prof = NULL;
 }
 
 //
@@ -991,8 +6892,59 @@ void init_gl()
 static void show_usage( const char *name )
 {
     fprintf( stderr,
-	"usage: %s [-d<devnum>]\n"
-	"-d <devnum> = select /dev/video<devnum>, default is 0\n",
+	"usage: %s [-d<devnum> | -i<file>] [-s<w>x<h>] [-r<fps>] [-F<format>] [-z] [-p<depth>] [-c] [-j<threads>]\n"
+	"       [-g<w>x<h>] [-k<keys>] [-n<frames>] [-o<output>] [-O<format>] [-P<file>]\n"
+	"       [-a<aniso>] [-b] [-G<fps>] [-e<radius>] [-C<dir>] [-m<levels>] [-M] [-S]\n"
+	"       [-B<buffers>] [-Q<policy>] [-v<x>,<y>,<zoom>] [-T]\n"
+	"-d <devnum> = select /dev/video<devnum>, default is 0\n"
+	"-i <file> = play raw frames from a file, or stdin for -, instead of a device\n"
+	"            (-d and -i can be given up to 9 times between them, sources after\n"
+	"            the first tile the plane with it, or take turns by iteration: 'l' key)\n"
+	"-s <w>x<h> = frame size of the -i file or -b test card, default is 640x480, or the\n"
+	"             size to capture at, default is the window size\n"
+	"-r <fps> = playback rate of the -i file, 0 for as fast as possible, or the rate to\n"
+	"           capture at, 0 for the driver's choice, default is 30\n"
+	"-S = capture at -s even if that is bigger than the window/output size\n"
+	"-B <buffers> = number of capture buffers, default is 4\n"
+	"-Q <policy> = which captured frames get rendered: latest (default) for the lowest\n"
+	"              latency, fifo to render every frame in order, or paced to render\n"
+	"              them a steady delay after capture for smooth motion\n"
+	"-F <format> = pixel format of the -i file: yuyv (default), nv12, i420 or mjpeg (from\n"
+	"              a regular file only), or the one to capture in rather than the best\n"
+	"              the device offers for the capture size\n"
+	"-z = capture straight into GL buffers (V4L2 USERPTR), falls back to copying\n"
+	"-p <depth> = number of PBOs in the video upload ring, default is 3\n"
+	"-c = render on the cpu (SSE2/AVX2) instead of with GLSL\n"
+	"-g <w>x<h> = window/output size, default is 640x480\n"
+	"-k <keys> = run these key commands at startup, e.g. \" ti\" to animate everything\n"
+	"-n <frames> = render this many frames headless (EGL, or no GL at all with -c) and exit\n"
+	"-o <output> = record to - for raw RGB on stdout, a pattern like out%%05d.ppm for\n"
+	"              numbered PPMs (headless only), or a file name, Y4M if it ends in\n"
+	"              .y4m and raw RGB otherwise, or a video output device such as a\n"
+	"              v4l2loopback one, YUYV by default; frames are dropped if the disk\n"
+	"              or device can't keep up with the window unless -Q fifo\n"
+	"-O <format> = what -o writes: rgb, y4m (4:2:0), or packed yuyv or nv12, all\n"
+	"              but rgb converted on the GPU before the readback\n"
+	"-T = check that yuv_prog and the -O conversions round trip and exit, at -s size\n"
+	"-j <threads> = number of cpu render threads, default is one per cpu\n"
+	"-P <file> = profile each stage, print p50/p95/p99 at exit and write every sample\n"
+	"            to <file> as CSV, or as a Chrome trace if it ends in .json, and print\n"
+	"            the latency from capture to dequeue, upload, draw and submit\n"
+	"-a <aniso> = limit anisotropic filtering, 1 turns it off (it's very slow on llvmpipe)\n"
+	"-b = benchmark a fixed set of scenarios headless and print CSV, -n sets the frames\n"
+	"     per scenario (default 20), the input is a test card unless -i is given,\n"
+	"     which is then played as fast as possible whatever -r says\n"
+	"-G <fps> = frame rate the governor ('g' key) holds by lowering resolution, then\n"
+	"           iterations, default is 60\n"
+	"-e <radius> = stop fetching once an orbit escapes this radius and use the video's\n"
+	"              mean colour for the rest ('e' key toggles it, default radius is 16)\n"
+	"-C <dir> = where to cache compiled shader programs, - for nowhere, default is\n"
+	"           $XDG_CACHE_HOME/vidbrot or ~/.cache/vidbrot\n"
+	"-m <levels> = build only this many mip levels above the video's own size,\n"
+	"              default is all of them (bailout always builds all of them)\n"
+	"-M = only rebuild the mip levels when the video frame changed\n"
+	"-v <x>,<y>,<zoom> = view center and zoom to start at, default is 0,-0.5,1.5 ('r' key),\n"
+	"                    the center is read at full precision for deep zooms ('z' key)\n",
 	name );
     exit( 0 );
 }
@@ -1003,17 +6955,188 @@ static void show_usage( const char *name )
 
 int main( int argc, char *argv[] )
 {
-    glutInit( &argc, argv );
+    // GLUT needs a display, so only let it see the arguments when we'll have one.
+    // Look for -n, -b and -T where an option can be, stepping over the values
+    // of the options that take one as the parse below does
+    static const char valued[] = "disrFpjgknoOPaeCmBQGv";
+    for (int i = 1; i < argc; ++i)
+    {
+	if ('-' != argv[i][0] || !argv[i][1]) continue;
+	if ('n' == argv[i][1] || (!argv[i][2] && ('b' == argv[i][1] || 'T' == argv[i][1]))) headless = true;
+	if (!argv[i][2] && strchr( valued, argv[i][1] )) ++i;
+    }
+    if (!headless) glutInit( &argc, argv );
 
     int vid_dev = 0;
+    const char *vid_file = NULL;
+    int n_sources = 0;
+    const char *input_files[max_inputs];	// -d and -i after the first, NULL for a device
+    int input_devs[max_inputs];
+    int n_input_specs = 0;
+    int file_w = 640, file_h = 480;
+    bool size_set = false;			// -s given, otherwise devices capture at the window size
+    double file_fps = 30;
+    uint32_t fourcc = 0;			// -F, 0 to negotiate with the device (YUYV for files)
+    bool use_cpu = false;
+    int cpu_threads = 0;
+    const char *keys = "";
+    int n_frames = 0;
+    const char *output = NULL;
+    bool bench = false;
+    bool check = false;
+
+    static char cache_dir[PATH_MAX];
+    const char *xdg = getenv( "XDG_CACHE_HOME" );
+    const char *home = getenv( "HOME" );
+    if (xdg && *xdg) snprintf( cache_dir, sizeof(cache_dir), "%s/vidbrot", xdg );
+    else if (home && *home) snprintf( cache_dir, sizeof(cache_dir), "%s/.cache/vidbrot", home );
+    if (*cache_dir) program_dir = cache_dir;
+
     for (int i = 1; i < argc; ++i)
     {
 	if (argv[i][0] == '-') switch (argv[i][1])
 	{
 	case 'd':
-	    if (argv[i][2]) vid_dev = atoi( &argv[i][2] );
-	    else if (i < argc - 1) vid_dev = atoi( argv[++i] );
+	case 'i':
+	{
+	    bool is_file = ('i' == argv[i][1]);
+	    const char *arg = argv[i][2] ? &argv[i][2] : (i < argc - 1) ? argv[++i] : NULL;
+	    if (!arg) break;
+	    const char *file = is_file ? arg : NULL;
+	    int dev = is_file ? 0 : atoi( arg );
+	    if (!n_sources++)
+	    {
+		vid_file = file;
+		vid_dev = dev;
+	    }
+	    else if (n_input_specs < max_inputs)
+	    {
+		input_files[n_input_specs] = file;
+		input_devs[n_input_specs++] = dev;
+	    }
+	    else FAIL(( "Too many video sources, %d at most", 1 + max_inputs ));
 	    break;
+	}
+	case 's':
+	{
+	    const char *arg = argv[i][2] ? &argv[i][2] : (i < argc - 1) ? argv[++i] : "";
+	    if (2 != sscanf( arg, "%dx%d", &file_w, &file_h )) show_usage( argv[0] );
+	    size_set = true;
+	    break;
+	}
+	case 'r':
+	    if (argv[i][2]) file_fps = atof( &argv[i][2] );
+	    else if (i < argc - 1) file_fps = atof( argv[++i] );
+	    break;
+	case 'F':
+	{
+	    const char *arg = argv[i][2] ? &argv[i][2] : (i < argc - 1) ? argv[++i] : "";
+	    fourcc = fourcc_from_name( arg );
+	    if (!fourcc) show_usage( argv[0] );
+	    break;
+	}
+	case 'z':
+	    zero_copy = true;
+	    break;
+	case 'p':
+	    if (argv[i][2]) upload_depth = atoi( &argv[i][2] );
+	    else if (i < argc - 1) upload_depth = atoi( argv[++i] );
+	    break;
+	case 'c':
+	    use_cpu = true;
+	    break;
+	case 'j':
+	    if (argv[i][2]) cpu_threads = atoi( &argv[i][2] );
+	    else if (i < argc - 1) cpu_threads = atoi( argv[++i] );
+	    break;
+	case 'g':
+	{
+	    const char *arg = argv[i][2] ? &argv[i][2] : (i < argc - 1) ? argv[++i] : "";
+	    if (2 != sscanf( arg, "%dx%d", &scr_w, &scr_h ) || scr_w <= 0 || scr_h <= 0) show_usage( argv[0] );
+	    break;
+	}
+	case 'k':
+	    if (argv[i][2]) keys = &argv[i][2];
+	    else if (i < argc - 1) keys = argv[++i];
+	    break;
+	case 'n':
+	    if (argv[i][2]) n_frames = atoi( &argv[i][2] );
+	    else if (i < argc - 1) n_frames = atoi( argv[++i] );
+	    break;
+	case 'o':
+	    if (argv[i][2]) output = &argv[i][2];
+	    else if (i < argc - 1) output = argv[++i];
+	    break;
+	case 'O':
+	{
+	    const char *arg = argv[i][2] ? &argv[i][2] : (i < argc - 1) ? argv[++i] : "";
+	    record_fmt = record_format_from_name( arg );
+	    if (N_RECORD_FORMATS == record_fmt) show_usage( argv[0] );
+	    break;
+	}
+	case 'P':
+	    if (argv[i][2]) prof_file = &argv[i][2];
+	    else if (i < argc - 1) prof_file = argv[++i];
+	    break;
+	case 'a':
+	    if (argv[i][2]) aniso_limit = atof( &argv[i][2] );
+	    else if (i < argc - 1) aniso_limit = atof( argv[++i] );
+	    break;
+	case 'b':
+	    bench = true;
+	    break;
+	case 'T':
+	    check = true;
+	    break;
+	case 'e':
+	    if (argv[i][2]) bailout_radius = atof( &argv[i][2] );
+	    else if (i < argc - 1) bailout_radius = atof( argv[++i] );
+	    if (bailout_radius <= 0) show_usage( argv[0] );
+	    bailout = true;
+	    break;
+	case 'C':
+	    if (argv[i][2]) program_dir = &argv[i][2];
+	    else if (i < argc - 1) program_dir = argv[++i];
+	    if (program_dir && !strcmp( program_dir, "-" )) program_dir = NULL;
+	    break;
+	case 'm':
+	    if (argv[i][2]) mip_levels = atoi( &argv[i][2] );
+	    else if (i < argc - 1) mip_levels = atoi( argv[++i] );
+	    if (mip_levels < 0) show_usage( argv[0] );
+	    break;
+	case 'M':
+	    mip_reuse = true;
+	    break;
+	case 'S':
+	    capture_capped = false;
+	    break;
+	case 'B':
+	    if (argv[i][2]) capture_buffers = atoi( &argv[i][2] );
+	    else if (i < argc - 1) capture_buffers = atoi( argv[++i] );
+	    if (capture_buffers < 2) show_usage( argv[0] );
+	    break;
+	case 'Q':
+	{
+	    const char *arg = argv[i][2] ? &argv[i][2] : (i < argc - 1) ? argv[++i] : "";
+	    capture_policy = queue_policy_from_name( arg );
+	    if (N_QUEUE_POLICIES == capture_policy) show_usage( argv[0] );
+	    break;
+	}
+	case 'G':
+	    if (argv[i][2]) target_fps = atof( &argv[i][2] );
+	    else if (i < argc - 1) target_fps = atof( argv[++i] );
+	    if (target_fps <= 0) show_usage( argv[0] );
+	    break;
+	case 'v':
+	{
+	    const char *arg = argv[i][2] ? &argv[i][2] : (i < argc - 1) ? argv[++i] : "";
+	    char *end;
+	    if (!deep_real::parse( arg, cx, &arg ) || ',' != *arg++ ||
+		!deep_real::parse( arg, cy, &arg ) || ',' != *arg++) show_usage( argv[0] );
+	    zoom = strtod( arg, &end );
+	    if (*end || zoom <= 0) show_usage( argv[0] );
+	    break;
+	}
 	case 'h':
 	    show_usage( argv[0] );
 	    break;
@@ -1021,35 +7144,129 @@ int main( int argc, char *argv[] )
 	else show_usage( argv[0] );
     }
 
-    glutInitDisplayMode( GLUT_DOUBLE | GLUT_RGB );
-    glutInitWindowSize( scr_w, scr_h );
-    glutCreateWindow( WINDOW_TITLE );
-    glutReshapeFunc( reshape );
-    glutDisplayFunc( display );
-    glutKeyboardFunc( keyboard );
-    glutSpecialFunc( special );
-    glutMouseFunc( mouse );
-    glutMotionFunc( motion );
+    if (check && use_cpu) FAIL(( "-T checks the GL conversions, not -c" ));
+    if (headless)
+    {
+	// the cpu renderer doesn't need GL at all
+	if (!use_cpu) init_egl();
+	zero_copy = false;
+	scr_aspect = scr_h / GLfloat(scr_w);
+    }
+    else
+    {
+	glutInitDisplayMode( GLUT_DOUBLE | GLUT_RGB );
+	glutInitWindowSize( scr_w, scr_h );
+	glutCreateWindow( WINDOW_TITLE );
+	glutReshapeFunc( reshape );
+	glutDisplayFunc( display );
+	glutKeyboardFunc( keyboard );
+	glutSpecialFunc( special );
+	glutMouseFunc( mouse );
+	glutMotionFunc( motion );
+
+	glutCreateMenu( command );
+	#define MK_MENU(label,value,case,cmd) \
+	glutAddMenuEntry( label, value );
+	LIST_COMMANDS(MK_MENU)
+	glutAttachMenu( GLUT_RIGHT_BUTTON );
+    }
+
+    if ((bench && !vid_file) || check) vidsrc = new pattern_source( file_w, file_h );
+    else
+    {
+	// devices capture at the window size unless told otherwise
+	int w = (vid_file || size_set) ? file_w : scr_w, h = (vid_file || size_set) ? file_h : scr_h;
+	// a paced file would time the pacing, not the renderer
+	if (bench) file_fps = 0;
+	capture_fps = file_fps;
+	capture_fourcc = fourcc;
+	vidsrc = open_source( vid_file, vid_dev, w, h, file_fps, fourcc, vidcap, converter );
+    }
+
+    // further sources become layers of rgb_tex, devices capture at the first one's size
+    if (n_input_specs && (use_cpu || bench || check)) DBUG(( "Only the first video source is used with -%c", use_cpu ? 'c' : bench ? 'b' : 'T' ));
+    else for (int k = 0; k < n_input_specs; ++k)
+    {
+	video_input &in = inputs[n_inputs++];
+	vid_capture *cap;
+	frame_converter *conv;
+	const char *file = input_files[k];
+	in.src = open_source( file, input_devs[k], file ? file_w : vidsrc->width(), file ? file_h : vidsrc->height(), file_fps, fourcc, cap, conv );
+	if (cap) cap->map();
+	in.raw = conv ? conv->source() : in.src;
+	in.thread = new capture_thread( in.src, capture_policy );
+	in.upload = NULL;
+	in.yuv_tex = 0;
+    }
+
+    // GL goes first so that zero-copy can hand its buffers to the capture device
+    if (use_cpu) cpu = new cpu_renderer( cpu_threads );
+    else init_gl();
+    if (headless && !use_cpu) init_screen_fb();
+
+    // without GL there is nothing to scale cpu headless output back up with
+    bool gl = !use_cpu || !headless;
+    governor = new frame_governor( target_fps, gl );
+    // -v can ask for more than the renderer can zoom
+    clamp_zoom();
 
-    glutCreateMenu( command );
-    #define MK_MENU(label,value,case,cmd) \
-    glutAddMenuEntry( label, value );
-    LIST_COMMANDS(MK_MENU)
-    glutAttachMenu( GLUT_RIGHT_BUTTON );
+    // benchmarks set their own view
+    if (!bench) for (const char *k = keys; *k; ++k) command( *k );
 
-    vidcap = new vid_capture( 4 );
-    vidcap->open( vid_dev );
-    vidcap->init( scr_w, scr_h );
-    vidcap->map();
-    vidcap->start();
+    if (prof_file)
+    {
+	// GLUT never returns from its main loop, so report from exit()
+	if (gl && !has_extension( "GL_ARB_timer_query" )) DBUG(( "No GL_ARB_timer_query, profiling the cpu side only" ));
+	prof = new profiler( gl && has_extension( "GL_ARB_timer_query" ) );
+	latency = new latency_log;
+	atexit( report_profile );
+    }
 
-    init_gl();
+    if (vidcap && !vidcap->userptr()) vidcap->map();
+    vidsrc->start();
+    capturing = true;
+    for (int k = 0; k < n_inputs; ++k)
+    {
+	inputs[k].src->start();
+	inputs[k].thread->start();
+    }
 
-    glutMainLoop();
+    int status = 0;
+    if (check) status = !check_output();
+    else if (bench) run_bench( n_frames ? n_frames : 20, vid_file ? vid_file : "pattern" );
+    else if (headless) run_headless( n_frames, output );
+    else
+    {
+	capthread = new capture_thread( vidsrc, capture_policy );
+	capthread->start();
+	// recording every frame holds the renderer back to the writer, like fifo does to the capture queue
+	if (output)
+	{
+	    start_recording( output, QUEUE_fifo == capture_policy );
+	    atexit( stop_recording );
+	}
+	glutMainLoop();
+    }
 
-    vidcap->stop();
-    vidcap->unmap();
-    delete vidcap;
+    // while the capture threads are still there to report on
+    report_profile();
+    delete capthread;
+    vidsrc->stop();
+    if (vidcap) vidcap->unmap();
+    frame_source *raw = converter ? converter->source() : vidsrc;
+    delete converter;
+    delete raw;
+    for (int k = 0; k < n_inputs; ++k)
+    {
+	video_input &in = inputs[k];
+	delete in.thread;
+	in.src->stop();
+	delete in.upload;
+	if (in.src != in.raw) delete in.src;
+	delete in.raw;
+    }
+    delete governor;
+    delete cpu;
     
-    return( 0 );
+    return( status );
 }